@@ -32,6 +32,7 @@
 #include <stdlib.h>
 
 #include "tab-page.h"
+#include "image-ops.h"
 
 #if !FM_CHECK_VERSION(1, 2, 0)
 typedef struct
@@ -495,6 +496,9 @@ static void fm_app_config_init(FmAppConfig *cfg)
     cfg->max_tab_chars = 32;
     cfg->media_in_new_tab = FALSE;
     cfg->desktop_folder_new_win = FALSE;
+    cfg->desktop_label_cache = 4096;
+    cfg->wallpaper_scale = IMAGE_OPS_SCALE_COMPAT;
+    cfg->filter_threshold = 10000;
 
     cfg->side_pane_mode = FM_SP_PLACES;
 
@@ -791,6 +795,9 @@ void fm_app_config_load_from_key_file(FmAppConfig* cfg, GKeyFile* kf)
         g_strfreev(tmpv);
     }
     fm_key_file_get_bool(kf, "ui", "pathbar_mode_buttons", &cfg->pathbar_mode_buttons);
+    fm_key_file_get_int(kf, "ui", "desktop_label_cache", &cfg->desktop_label_cache);
+    fm_key_file_get_int(kf, "ui", "wallpaper_scale", &cfg->wallpaper_scale);
+    fm_key_file_get_int(kf, "ui", "filter_threshold", &cfg->filter_threshold);
 }
 
 void fm_app_config_load_from_profile(FmAppConfig* cfg, const char* name)
@@ -1172,6 +1179,9 @@ void fm_app_config_save_profile(FmAppConfig* cfg, const char* name)
         g_string_append_c(buf, '\n');
         g_string_append_printf(buf, "show_statusbar=%d\n", cfg->show_statusbar);
         g_string_append_printf(buf, "pathbar_mode_buttons=%d\n", cfg->pathbar_mode_buttons);
+        g_string_append_printf(buf, "desktop_label_cache=%d\n", cfg->desktop_label_cache);
+        g_string_append_printf(buf, "wallpaper_scale=%d\n", cfg->wallpaper_scale);
+        g_string_append_printf(buf, "filter_threshold=%d\n", cfg->filter_threshold);
 
         path = g_build_filename(dir_path, "pcmanfm.conf", NULL);
         g_file_set_contents(path, buf->str, buf->len, NULL);
@@ -129,6 +129,9 @@ struct _FmAppConfig
 #endif
     gboolean maximized;
     gboolean pathbar_mode_buttons;
+    int desktop_label_cache; /* memory for rendered desktop labels, in KiB */
+    int wallpaper_scale; /* ImageOpsScaleMode used for wallpapers */
+    int filter_threshold; /* filter folders with more files in threads, 0 to never */
 
     FmSidePaneMode side_pane_mode;
 
@@ -0,0 +1,112 @@
+#!/bin/sh
+#
+#      bench-desktop.sh: runs the desktop on a generated folder and prints
+#      the timings it logs
+#
+#      pcmanfm should be configured with --enable-debug so the desktop
+#      reports its timings with g_debug(). The desktop is shown on $DISPLAY
+#      so use a virtual X server to not replace the running desktop, e.g.
+#          xvfb-run -s '-screen 0 1920x1080x24' ./bench-desktop.sh ./pcmanfm
+#
+#      Configuration and the desktop folder are created in a temporary
+#      directory, the configuration of the user is not touched.
+#
+#      This program is free software; you can redistribute it and/or modify
+#      it under the terms of the GNU General Public License as published by
+#      the Free Software Foundation; either version 2 of the License, or
+#      (at your option) any later version.
+
+usage()
+{
+    echo "usage: $0 [-c] [-n ITEMS] [-f FIXED] [-r REPAINTS] [-s WxH]" >&2
+    echo "       [-t SECONDS] [PCMANFM]" >&2
+    echo "  -c          save positions in desktop-items-0.conf, the old format" >&2
+    echo "  -n ITEMS    files in the desktop folder (10000)" >&2
+    echo "  -f FIXED    items with a saved position (1000)" >&2
+    echo "  -r REPAINTS full repaints forced with xrefresh, one a second (0)" >&2
+    echo "  -s WxH      size of the screen to spread positions over (1920x1080)" >&2
+    echo "  -t SECONDS  time to run the desktop (10)" >&2
+    exit 2
+}
+
+items=10000
+fixed=1000
+repaints=0
+screen=1920x1080
+secs=10
+old_conf=0
+while getopts cn:f:r:s:t: opt; do
+    case $opt in
+    c) old_conf=1 ;;
+    n) items=$OPTARG ;;
+    f) fixed=$OPTARG ;;
+    r) repaints=$OPTARG ;;
+    s) screen=$OPTARG ;;
+    t) secs=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+pcmanfm=${1:-pcmanfm}
+[ "$fixed" -le "$items" ] || usage
+# repaints start after the first half of the run when items are loaded
+[ "$repaints" -eq 0 ] || [ "$repaints" -lt $((secs / 2)) ] || usage
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+profile="$tmp/config/pcmanfm/default"
+mkdir -p "$tmp/Desktop" "$profile" "$tmp/cache" "$tmp/runtime"
+chmod 700 "$tmp/runtime"
+echo "XDG_DESKTOP_DIR=\"$tmp/Desktop\"" > "$tmp/config/user-dirs.dirs"
+
+# every n/f-th item gets a random position on the screen, the desktop
+# pulls positions out of the screen back to its edge anyway; with -c they
+# are written as groups of the config file which the desktop migrates
+# into desktop-items-0.pos on the first start
+awk -v n="$items" -v f="$fixed" -v dir="$tmp/Desktop" -v screen="$screen" \
+    -v conf="$profile/desktop-items-0.conf" -v old_conf="$old_conf" \
+    -v pos="$profile/desktop-items-0.pos" 'BEGIN {
+    split(screen, size, "x")
+    srand(1)
+    print "[*]\nwallpaper_mode=color\n" > conf
+    if (!old_conf)
+        print "#pcmanfm-item-positions 1" > pos
+    for (i = 0; i < n; i++) {
+        name = sprintf("item-%05d.txt", i)
+        printf "" > (dir "/" name)
+        close(dir "/" name)
+        if (f > 0 && i % int(n / f) == 0 && placed < f) {
+            x = int(rand() * (size[1] - 100))
+            y = int(rand() * (size[2] - 100))
+            if (old_conf)
+                printf "[%s]\nx=%d\ny=%d\n\n", name, x, y > conf
+            else
+                printf "=%d %d %s\n", x, y, name > pos
+            placed++
+        }
+    }
+}' || exit 1
+
+echo "$items items, $fixed fixed, running $pcmanfm --desktop for $secs s" >&2
+env G_MESSAGES_DEBUG=all XDG_CONFIG_HOME="$tmp/config" \
+    XDG_CACHE_HOME="$tmp/cache" XDG_RUNTIME_DIR="$tmp/runtime" \
+    timeout "$secs" "$pcmanfm" --desktop > "$tmp/log" 2>&1 &
+pid=$!
+if [ "$repaints" -gt 0 ]; then
+    sleep $((secs / 2))
+    i=0
+    while [ $i -lt "$repaints" ]; do
+        xrefresh || break
+        sleep 1
+        i=$((i + 1))
+    done
+fi
+wait $pid
+grep 'FmDesktop:' "$tmp/log"
+# forced repaints paint every item on the screen, others may paint a few
+awk '/FmDesktop: expose/ {
+    n++; t = $(NF - 1); sum += t; if (t > max) max = t
+} END {
+    if (n) printf "%d exposes: mean %.3f ms, max %.3f ms\n", n, sum / n, max
+}' "$tmp/log"
+exit 0
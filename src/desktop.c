@@ -29,17 +29,25 @@
 #include "pcmanfm.h"
 
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include <gdk/gdkx.h>
 #include <gdk/gdkkeysyms.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
+#include <fcntl.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <cairo-xlib.h>
 
 #include "pref.h"
 #include "main-win.h"
+#include "image-ops.h"
 
 #include "gseal-gtk-compat.h"
 
@@ -59,28 +67,54 @@
 struct _FmDesktopItem
 {
     FmFileInfo* fi;
+    GtkTreeIter it; /* the model row, FmFolderModel iters are persistent */
     GdkRectangle area; /* position of the item on the desktop */
     GdkRectangle icon_rect;
     GdkRectangle text_rect;
+    /* range of spatial index buckets the item is linked into */
+    guint16 grid_x1, grid_y1, grid_x2, grid_y2;
+    guint grid_stamp; /* last query which visited the item */
     gboolean is_special : 1; /* is this a special item like "My Computer", mounted volume, or "Trash" */
     gboolean is_mount : 1; /* is this a mounted volume*/
     gboolean is_selected : 1;
     gboolean is_rubber_banded : 1;
     gboolean is_prelight : 1;
     gboolean fixed_pos : 1;
+    gboolean in_grid : 1; /* is linked into the spatial index */
+    gboolean is_placed : 1; /* was placed by layout and has size calculated */
+    gint layout_x, layout_y; /* slot where layout started to place item */
+    PangoLayout *pl; /* shaped label, see get_item_layout() */
+    PangoRectangle text_extents; /* logical pixel extents of pl */
+    guint text_serial; /* desktop->text_serial when pl was shaped */
+    cairo_surface_t *label; /* rendered label, see get_item_label() */
+    GList *label_link; /* link in desktop->label_cache */
+    guint32 label_fg, label_bg; /* colors the label was rendered with */
+    gboolean label_selected : 1;
+    GList *sel_link; /* link in desktop->selected */
+    guint nav_index; /* position in model, see update_nav_index() */
+    guint nav_pos; /* position in desktop->nav_by_x */
+    char *search_key; /* casefolded name for type-ahead search */
+};
+
+struct _FmDesktopGrid
+{
+    GSList **buckets; /* cols * rows lists of items */
+    gint x, y; /* origin of the grid on the desktop */
+    guint cols, rows;
+    guint bucket_w, bucket_h;
+    guint stamp; /* serial of the last query */
 };
 
 struct _FmBackgroundCache
 {
-    FmBackgroundCache *next;
+    char *key; /* key in bg_cache_store */
     char *filename;
 #if GTK_CHECK_VERSION(3, 0, 0)
     cairo_surface_t *bg;
 #else
     GdkPixmap *bg;
 #endif
-    FmWallpaperMode wallpaper_mode;
-    time_t mtime;
+    guint ref; /* number of desktops which hold it */
 };
 
 static void queue_layout_items(FmDesktop* desktop);
@@ -92,6 +126,7 @@ static void _select_all(FmFolderView* fv);
 static void _unselect_all(FmFolderView* fv);
 
 static FmDesktopItem* hit_test(FmDesktop* self, GtkTreeIter *it, int x, int y);
+static void update_hover(FmDesktop* self, int x, int y);
 
 static void fm_desktop_view_init(FmFolderViewInterface* iface);
 
@@ -177,7 +212,8 @@ static GSList *mounts = NULL;
 /* ---------------------------------------------------------------------
     Items management and common functions */
 
-static char* get_config_file(FmDesktop* desktop, gboolean create_dir)
+static char* get_desktop_file(FmDesktop* desktop, gboolean create_dir,
+                              const char *suffix)
 {
     char *dir, *path;
     int i;
@@ -188,11 +224,25 @@ static char* get_config_file(FmDesktop* desktop, gboolean create_dir)
     if(i >= n_screens)
         return NULL;
     dir = pcmanfm_get_profile_dir(create_dir);
-    path = g_strdup_printf("%s/desktop-items-%u.conf", dir, i);
+    path = g_strdup_printf("%s/desktop-items-%u.%s", dir, i, suffix);
     g_free(dir);
     return path;
 }
 
+#define get_config_file(desktop,create_dir) get_desktop_file(desktop, create_dir, "conf")
+#define get_item_pos_file(desktop,create_dir) get_desktop_file(desktop, create_dir, "pos")
+
+/* returns normalized casefolded text to compare in type-ahead search */
+static char *make_search_key(const char *text)
+{
+    char *casefold = g_utf8_casefold(text, -1);
+    char *key = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
+
+    g_free(casefold);
+    /* invalid UTF-8 cannot be normalized so let it never match */
+    return key ? key : g_strdup("");
+}
+
 static inline FmDesktopItem* desktop_item_new(FmFolderModel* model, GtkTreeIter* it)
 {
     FmDesktopItem* item = g_slice_new0(FmDesktopItem);
@@ -200,8 +250,10 @@ static inline FmDesktopItem* desktop_item_new(FmFolderModel* model, GtkTreeIter*
     GSList *sl;
 #endif
     fm_folder_model_set_item_userdata(model, it, item);
+    item->it = *it;
     gtk_tree_model_get(GTK_TREE_MODEL(model), it, FM_FOLDER_MODEL_COL_INFO, &item->fi, -1);
     fm_file_info_ref(item->fi);
+    item->search_key = make_search_key(fm_file_info_get_disp_name(item->fi));
 #if FM_CHECK_VERSION(1, 2, 0)
     if ((trash_can && trash_can->fi == item->fi) ||
         (documents && documents->fi == item->fi))
@@ -221,9 +273,113 @@ static inline void desktop_item_free(FmDesktopItem* item)
 {
     if(item->fi)
         fm_file_info_unref(item->fi);
+    if(item->pl)
+        g_object_unref(item->pl);
+    g_free(item->search_key);
     g_slice_free(FmDesktopItem, item);
 }
 
+/* the only place where is_selected should be changed, it keeps the list
+   of selected items and their bounding box up to date */
+static void set_item_selected(FmDesktop* desktop, FmDesktopItem* item,
+                              gboolean selected)
+{
+    GdkRectangle *area = &desktop->sel_area;
+
+    /* we cannot compare booleans, TRUE may be 1 or -1 */
+    if (!item->is_selected == !selected)
+        return;
+    item->is_selected = selected;
+    if (selected)
+    {
+        g_queue_push_tail(&desktop->selected, item);
+        item->sel_link = desktop->selected.tail;
+        if (desktop->selected.length == 1)
+        {
+            *area = item->icon_rect;
+            desktop->sel_area_valid = TRUE;
+        }
+        else if (desktop->sel_area_valid)
+            gdk_rectangle_union(area, &item->icon_rect, area);
+    }
+    else
+    {
+        g_queue_delete_link(&desktop->selected, item->sel_link);
+        item->sel_link = NULL;
+        /* the box shrinks only if the item touches its border */
+        if (desktop->sel_area_valid &&
+            (item->icon_rect.x <= area->x || item->icon_rect.y <= area->y ||
+             item->icon_rect.x + item->icon_rect.width >= area->x + area->width ||
+             item->icon_rect.y + item->icon_rect.height >= area->y + area->height))
+            desktop->sel_area_valid = FALSE;
+    }
+}
+
+/* returns FALSE if nothing is selected */
+static gboolean get_selection_area(FmDesktop* desktop, GdkRectangle* area)
+{
+    GList *l;
+    FmDesktopItem *item;
+
+    if (desktop->selected.length == 0)
+        return FALSE;
+    if (!desktop->sel_area_valid)
+    {
+        l = desktop->selected.head;
+        item = l->data;
+        desktop->sel_area = item->icon_rect;
+        for (l = l->next; l; l = l->next)
+        {
+            item = l->data;
+            gdk_rectangle_union(&desktop->sel_area, &item->icon_rect,
+                                &desktop->sel_area);
+        }
+        desktop->sel_area_valid = TRUE;
+    }
+    *area = desktop->sel_area;
+    return TRUE;
+}
+
+static void drop_item_label(FmDesktop* desktop, FmDesktopItem* item)
+{
+    if(item->label == NULL)
+        return;
+    desktop->label_cache_size -= cairo_image_surface_get_stride(item->label)
+                                 * cairo_image_surface_get_height(item->label);
+    cairo_surface_destroy(item->label);
+    item->label = NULL;
+    g_queue_delete_link(&desktop->label_cache, item->label_link);
+    item->label_link = NULL;
+}
+
+static void clear_label_cache(FmDesktop* desktop)
+{
+    FmDesktopItem* item;
+
+    while((item = g_queue_peek_head(&desktop->label_cache)) != NULL)
+        drop_item_label(desktop, item);
+}
+
+/* returns the label layout of item, it is shaped only once and kept until
+   the name, font, direction or label size is changed */
+static PangoLayout *get_item_layout(FmDesktop* desktop, FmDesktopItem* item)
+{
+    if(item->pl == NULL || item->text_serial != desktop->text_serial)
+    {
+        drop_item_label(desktop, item);
+        if(item->pl)
+            g_object_unref(item->pl);
+        /* copy settings of the desktop layout, it has no text set */
+        item->pl = pango_layout_copy(desktop->pl);
+        pango_layout_set_height(item->pl, desktop->pango_text_h);
+        pango_layout_set_width(item->pl, desktop->pango_text_w);
+        pango_layout_set_text(item->pl, fm_file_info_get_disp_name(item->fi), -1);
+        pango_layout_get_pixel_extents(item->pl, NULL, &item->text_extents);
+        item->text_serial = desktop->text_serial;
+    }
+    return item->pl;
+}
+
 static void calc_item_size(FmDesktop* desktop, FmDesktopItem* item, GdkPixbuf* icon)
 {
     PangoRectangle rc2;
@@ -244,13 +400,8 @@ static void calc_item_size(FmDesktop* desktop, FmDesktopItem* item, GdkPixbuf* i
     item->icon_rect.height += desktop->spacing; // FIXME: this is probably wrong
 
     /* text label rect */
-    pango_layout_set_text(desktop->pl, NULL, 0);
-    pango_layout_set_height(desktop->pl, desktop->pango_text_h);
-    pango_layout_set_width(desktop->pl, desktop->pango_text_w);
-    pango_layout_set_text(desktop->pl, fm_file_info_get_disp_name(item->fi), -1);
-
-    pango_layout_get_pixel_extents(desktop->pl, NULL, &rc2);
-    pango_layout_set_text(desktop->pl, NULL, 0);
+    get_item_layout(desktop, item);
+    rc2 = item->text_extents;
 
     /* FIXME: RTL */
     item->text_rect.x = item->area.x + (desktop->cell_w - rc2.width - 4) / 2;
@@ -259,94 +410,405 @@ static void calc_item_size(FmDesktop* desktop, FmDesktopItem* item, GdkPixbuf* i
     item->text_rect.height = rc2.y + rc2.height + 4;
     item->area.width = (desktop->cell_w + MAX(item->icon_rect.width, item->text_rect.width)) / 2;
     item->area.height = item->text_rect.y + item->text_rect.height - item->area.y;
+    if (item->is_selected)
+        desktop->sel_area_valid = FALSE;
+}
+
+/* ---------------------------------------------------------------------
+    Item positions store
+
+    Positions of fixed items are kept in the file desktop-items-N.pos:
+    the header line and then records, one per line, each either
+        =<x> <y> <name>
+    to set position of item with file name <name>, or
+        -<name>
+    to forget it. Changes are appended to the file and it is rewritten
+    only when there are too many outdated records in it. The last line
+    which has no newline is an interrupted append and is ignored. */
+
+#define ITEM_POS_FILE_HEADER "#pcmanfm-item-positions 1"
+#define ITEM_POS_COMPACT_SLACK 64 /* outdated records allowed in the file */
+
+typedef struct
+{
+    gint x, y;
+    guint stamp; /* desktop->pos_stamp when the item was saved last time */
+} FmDesktopItemPos;
+
+static void _item_pos_append(GString *buf, const char *name,
+                             const FmDesktopItemPos *pos)
+{
+    if (pos)
+        g_string_append_printf(buf, "=%d %d ", pos->x, pos->y);
+    else
+        g_string_append_c(buf, '-');
+    for (; *name; name++)
+    {
+        switch (*name)
+        {
+        case '\r':
+            g_string_append(buf, "\\r");
+            break;
+        case '\n':
+            g_string_append(buf, "\\n");
+            break;
+        case '\\':
+            g_string_append(buf, "\\\\");
+            break;
+        default:
+            g_string_append_c(buf, *name);
+        }
+    }
+    g_string_append_c(buf, '\n');
+}
+
+/* unescapes name in place */
+static void _item_pos_unescape(char *name)
+{
+    char *out = name;
+
+    for (; *name; name++)
+    {
+        if (*name == '\\' && name[1])
+        {
+            name++;
+            *out++ = (*name == 'n') ? '\n' : (*name == 'r') ? '\r' : *name;
+        }
+        else
+            *out++ = *name;
+    }
+    *out = '\0';
+}
+
+/* returns FALSE if file is missing or has an unknown format */
+static gboolean _item_pos_read(FmDesktop *desktop, const char *path,
+                               gboolean *interrupted)
+{
+    char *contents, *line, *end, *name;
+    gsize len;
+    FmDesktopItemPos *pos;
+    long x, y;
+
+    if (!g_file_get_contents(path, &contents, &len, NULL))
+        return FALSE;
+    if (!g_str_has_prefix(contents, ITEM_POS_FILE_HEADER "\n"))
+    {
+        g_warning("desktop: unknown format of %s, ignoring it", path);
+        g_free(contents);
+        return FALSE;
+    }
+    line = contents + strlen(ITEM_POS_FILE_HEADER "\n");
+    desktop->pos_records = 0;
+    while ((end = memchr(line, '\n', contents + len - line)) != NULL)
+    {
+        *end = '\0';
+        if (line[0] == '=')
+        {
+            x = strtol(line + 1, &name, 10);
+            if (*name == ' ')
+            {
+                y = strtol(name + 1, &name, 10);
+                if (*name == ' ' && name[1])
+                {
+                    _item_pos_unescape(++name);
+                    pos = g_hash_table_lookup(desktop->positions, name);
+                    if (pos == NULL)
+                    {
+                        pos = g_new0(FmDesktopItemPos, 1);
+                        g_hash_table_insert(desktop->positions, g_strdup(name), pos);
+                    }
+                    pos->x = (gint)x;
+                    pos->y = (gint)y;
+                }
+            }
+        }
+        else if (line[0] == '-' && line[1])
+        {
+            _item_pos_unescape(line + 1);
+            g_hash_table_remove(desktop->positions, line + 1);
+        }
+        desktop->pos_records++;
+        line = end + 1;
+    }
+    *interrupted = (line != contents + len);
+    g_free(contents);
+    return TRUE;
+}
+
+/* the file may miss some records now, these will be written on the next
+   save_item_pos() by compaction since there is nothing to append to */
+static void _item_pos_write_failed(FmDesktop *desktop)
+{
+    desktop->pos_records = 2 * g_hash_table_size(desktop->positions)
+                           + ITEM_POS_COMPACT_SLACK + 1;
+    desktop->pos_changed = TRUE;
+}
+
+/* writes file anew with only actual records */
+static void _item_pos_compact(FmDesktop *desktop)
+{
+    char *path = get_item_pos_file(desktop, TRUE);
+    GHashTableIter iter;
+    gpointer name, pos;
+    GString *buf;
+
+    if (!path)
+    {
+        _item_pos_write_failed(desktop);
+        return;
+    }
+    buf = g_string_sized_new(64 * g_hash_table_size(desktop->positions) + 64);
+    g_string_append(buf, ITEM_POS_FILE_HEADER "\n");
+    g_hash_table_iter_init(&iter, desktop->positions);
+    while (g_hash_table_iter_next(&iter, &name, &pos))
+        _item_pos_append(buf, name, pos);
+    /* it writes a temporary file and renames it so it is atomic */
+    if (g_file_set_contents(path, buf->str, buf->len, NULL))
+        desktop->pos_records = g_hash_table_size(desktop->positions);
+    else
+        _item_pos_write_failed(desktop);
+    g_string_free(buf, TRUE);
+    g_free(path);
+}
+
+/* positions from groups of desktop-items-N.conf where they were before,
+   kf is the parsed file or NULL if it should be read here */
+static void _item_pos_migrate(FmDesktop *desktop, GKeyFile *conf_kf)
+{
+    char *path = NULL;
+    GKeyFile *kf = conf_kf;
+    char **groups;
+    FmDesktopItemPos *pos;
+    guint i;
+
+    if (kf == NULL)
+    {
+        path = get_config_file(desktop, FALSE);
+        if (!path)
+            return;
+        kf = g_key_file_new();
+        if (!g_key_file_load_from_file(kf, path, 0, NULL))
+        {
+            g_key_file_free(kf);
+            g_free(path);
+            return;
+        }
+    }
+    groups = g_key_file_get_groups(kf, NULL);
+    for (i = 0; groups[i]; i++)
+    {
+        /* item "*" is desktop config */
+        if (strcmp(groups[i], "*") == 0)
+            continue;
+        pos = g_new0(FmDesktopItemPos, 1);
+        pos->x = g_key_file_get_integer(kf, groups[i], "x", NULL);
+        pos->y = g_key_file_get_integer(kf, groups[i], "y", NULL);
+        g_hash_table_replace(desktop->positions, g_strdup(groups[i]), pos);
+    }
+    g_strfreev(groups);
+    if (kf != conf_kf)
+        g_key_file_free(kf);
+    g_free(path);
 }
 
-/* unfortunately we cannot load the "*" together with items because
-   otherwise we will update pango layout on each load_items() which
-   is resource wasting so we load config file once more instead */
-static inline void load_config(FmDesktop* desktop)
+/* loads desktop->positions once, conf_kf is desktop-items-N.conf if it
+   was parsed already, it is used to migrate positions from there */
+static void load_item_pos(FmDesktop* desktop, GKeyFile *conf_kf)
+{
+    char *path;
+    gboolean interrupted = FALSE;
+
+    if (desktop->positions)
+        return;
+    desktop->positions = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free, g_free);
+    path = get_item_pos_file(desktop, FALSE);
+    if (!path)
+        return;
+    if (!_item_pos_read(desktop, path, &interrupted))
+    {
+        _item_pos_migrate(desktop, conf_kf);
+        _item_pos_compact(desktop);
+    }
+    else if (interrupted) /* don't append after a broken line */
+        _item_pos_compact(desktop);
+    g_free(path);
+}
+
+/* save position of desktop icons: only changes since last save are
+   appended to the file, the file is compacted if it grew too much */
+static void save_item_pos(FmDesktop* desktop)
+{
+    GList* l;
+    GString* buf;
+    GHashTableIter iter;
+    gpointer name, value;
+    FmDesktopItemPos *pos;
+    char *path;
+    guint n = 0;
+    FILE *f;
+    gboolean ok;
+
+    /* without model we don't know items so cannot tell what was removed */
+    if (desktop->model == NULL)
+        return;
+    load_item_pos(desktop, NULL);
+    desktop->pos_changed = FALSE; /* reset it since we save it now */
+    buf = g_string_sized_new(1024);
+    desktop->pos_stamp++;
+    for (l = desktop->fixed_items; l; l = l->next)
+    {
+        FmDesktopItem* item = (FmDesktopItem*)l->data;
+        const char *item_name = fm_file_info_get_name(item->fi);
+
+        pos = g_hash_table_lookup(desktop->positions, item_name);
+        if (pos == NULL)
+        {
+            pos = g_new0(FmDesktopItemPos, 1);
+            g_hash_table_insert(desktop->positions, g_strdup(item_name), pos);
+        }
+        else if (pos->x == item->area.x && pos->y == item->area.y)
+        {
+            pos->stamp = desktop->pos_stamp;
+            continue;
+        }
+        pos->x = item->area.x;
+        pos->y = item->area.y;
+        pos->stamp = desktop->pos_stamp;
+        _item_pos_append(buf, item_name, pos);
+        n++;
+    }
+    /* items which aren't fixed anymore */
+    g_hash_table_iter_init(&iter, desktop->positions);
+    while (g_hash_table_iter_next(&iter, &name, &value))
+    {
+        if (((FmDesktopItemPos*)value)->stamp == desktop->pos_stamp)
+            continue;
+        _item_pos_append(buf, name, NULL);
+        g_hash_table_iter_remove(&iter);
+        n++;
+    }
+
+    /* after a failed write the file is compacted even without changes */
+    desktop->pos_records += n;
+    if (desktop->pos_records > 2 * g_hash_table_size(desktop->positions)
+                               + ITEM_POS_COMPACT_SLACK)
+        _item_pos_compact(desktop);
+    else if (n > 0)
+    {
+        path = get_item_pos_file(desktop, TRUE);
+        f = path ? fopen(path, "ab") : NULL;
+        if (f == NULL)
+            _item_pos_write_failed(desktop);
+        else
+        {
+            ok = TRUE;
+            /* new file should get the header first */
+            if (fseek(f, 0, SEEK_END) == 0 && ftell(f) == 0)
+                ok = (fputs(ITEM_POS_FILE_HEADER "\n", f) >= 0);
+            /* the records are written at once so on failure only last
+               line may be broken, and load_item_pos() will fix it */
+            if (fwrite(buf->str, 1, buf->len, f) != buf->len)
+                ok = FALSE;
+            if (fclose(f) != 0 || !ok)
+                _item_pos_write_failed(desktop);
+        }
+        g_free(path);
+    }
+    g_string_free(buf, TRUE);
+}
+
+/* the config file is parsed once: desktop config is in its group "*" and
+   positions which may be in other groups are migrated from the same data;
+   positions are kept in desktop->positions until model rows arrive */
+static void load_config(FmDesktop* desktop)
 {
     char* path;
     GKeyFile* kf;
+#ifdef G_ENABLE_DEBUG
+    GTimer *timer;
+#endif
 
     path = get_config_file(desktop, FALSE);
     if(!path)
         return;
+#ifdef G_ENABLE_DEBUG
+    timer = g_timer_new();
+#endif
     kf = g_key_file_new();
     if(g_key_file_load_from_file(kf, path, 0, NULL))
         /* item "*" is desktop config */
         fm_app_config_load_desktop_config(kf, "*", &desktop->conf);
+    load_item_pos(desktop, kf);
     g_free(path);
     g_key_file_free(kf);
+#ifdef G_ENABLE_DEBUG
+    g_debug("FmDesktop: config and %u item positions (%u records) loaded in %.3f ms",
+            g_hash_table_size(desktop->positions), desktop->pos_records,
+            g_timer_elapsed(timer, NULL) * 1000.0);
+    g_timer_destroy(timer);
+#endif
 }
 
 static inline void load_items(FmDesktop* desktop)
 {
     GtkTreeIter it;
-    char* path;
     GtkTreeModel* model;
-    GKeyFile* kf;
+    FmDesktopItemPos* pos;
 
     if (desktop->model == NULL)
         return;
     model = GTK_TREE_MODEL(desktop->model);
     if (!gtk_tree_model_get_iter_first(model, &it))
         return;
-    path = get_config_file(desktop, FALSE);
-    if(!path)
-        return;
-    kf = g_key_file_new();
-    if(g_key_file_load_from_file(kf, path, 0, NULL))
+    /* positions are usually loaded by load_config() on realize already */
+    load_item_pos(desktop, NULL);
+    do
     {
-        do
-        {
-            FmDesktopItem* item;
-            const char* name;
-            GdkPixbuf* icon = NULL;
-            int out; /* out of bounds */
+        FmDesktopItem* item;
+        GdkPixbuf* icon = NULL;
+        int out; /* out of bounds */
 
-            item = fm_folder_model_get_item_userdata(desktop->model, &it);
-            name = fm_file_info_get_name(item->fi);
-            if(g_key_file_has_group(kf, name))
+        item = fm_folder_model_get_item_userdata(desktop->model, &it);
+        pos = g_hash_table_lookup(desktop->positions, fm_file_info_get_name(item->fi));
+        if(pos)
+        {
+            gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
+            desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
+            item->fixed_pos = TRUE;
+            item->area.x = pos->x;
+            item->area.y = pos->y;
+            /* pull item into screen bounds */
+            if (item->area.x < desktop->xmargin + desktop->working_area.x)
+                item->area.x = desktop->xmargin + desktop->working_area.x;
+            if (item->area.y < desktop->ymargin + desktop->working_area.y)
+                item->area.y = desktop->ymargin + desktop->working_area.y;
+            calc_item_size(desktop, item, icon);
+            /* check if item is in screen bounds and pull it if it's not */
+            out = item->area.x + item->area.width + desktop->xmargin - desktop->working_area.width - desktop->working_area.x;
+            if (out > 0)
             {
-                gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
-                desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
-                item->fixed_pos = TRUE;
-                item->area.x = g_key_file_get_integer(kf, name, "x", NULL);
-                item->area.y = g_key_file_get_integer(kf, name, "y", NULL);
-                /* pull item into screen bounds */
-                if (item->area.x < desktop->xmargin + desktop->working_area.x)
-                    item->area.x = desktop->xmargin + desktop->working_area.x;
-                if (item->area.y < desktop->ymargin + desktop->working_area.y)
-                    item->area.y = desktop->ymargin + desktop->working_area.y;
-                calc_item_size(desktop, item, icon);
-                /* check if item is in screen bounds and pull it if it's not */
-                out = item->area.x + item->area.width + desktop->xmargin - desktop->working_area.width - desktop->working_area.x;
-                if (out > 0)
-                {
-                    if (out > item->area.x - desktop->xmargin)
-                        out = item->area.x - desktop->xmargin;
-                    item->area.x -= out;
-                    item->icon_rect.x -= out;
-                    item->text_rect.x -= out;
-                }
-                out = item->area.y + item->area.height + desktop->ymargin - desktop->working_area.height - desktop->working_area.y;
-                if (out > 0)
-                {
-                    if (out > item->area.y - desktop->ymargin)
-                        out = item->area.y - desktop->ymargin;
-                    item->area.y -= out;
-                    item->icon_rect.y -= out;
-                    item->text_rect.y -= out;
-                }
-                if(icon)
-                    g_object_unref(icon);
+                if (out > item->area.x - desktop->xmargin)
+                    out = item->area.x - desktop->xmargin;
+                item->area.x -= out;
+                item->icon_rect.x -= out;
+                item->text_rect.x -= out;
+            }
+            out = item->area.y + item->area.height + desktop->ymargin - desktop->working_area.height - desktop->working_area.y;
+            if (out > 0)
+            {
+                if (out > item->area.y - desktop->ymargin)
+                    out = item->area.y - desktop->ymargin;
+                item->area.y -= out;
+                item->icon_rect.y -= out;
+                item->text_rect.y -= out;
             }
+            if(icon)
+                g_object_unref(icon);
         }
-        while(gtk_tree_model_iter_next(model, &it));
     }
-    g_free(path);
-    g_key_file_free(kf);
+    while(gtk_tree_model_iter_next(model, &it));
+    desktop->nav_valid = FALSE;
     queue_layout_items(desktop);
 }
 
@@ -358,7 +820,6 @@ static inline void unload_items(FmDesktop* desktop)
     desktop->focus = NULL;
     desktop->drop_hilight = NULL;
     desktop->hover_item = NULL;
-    g_object_set(G_OBJECT(desktop), "tooltip-text", NULL, NULL);
 }
 
 static inline void reload_items(FmDesktop *desktop)
@@ -386,10 +847,9 @@ static gint get_desktop_for_root_window(GdkWindow *root)
     return desktop;
 }
 
-/* save position of desktop icons */
-static void save_item_pos(FmDesktop* desktop)
+/* save desktop config, item positions are saved by save_item_pos() */
+static void save_config(FmDesktop* desktop)
 {
-    GList* l;
     GString* buf;
     char* path = get_config_file(desktop, TRUE);
 
@@ -399,47 +859,7 @@ static void save_item_pos(FmDesktop* desktop)
 
     /* save desktop config */
     if (desktop->conf.configured)
-    {
         fm_app_config_save_desktop_config(buf, "*", &desktop->conf);
-        g_string_append_c(buf, '\n');
-    }
-
-    /* save all items positions */
-    for(l = desktop->fixed_items; l; l=l->next)
-    {
-        FmDesktopItem* item = (FmDesktopItem*)l->data;
-        FmPath* fi_path = fm_file_info_get_path(item->fi);
-        const char* p;
-        /* write the file basename as group name */
-        g_string_append_c(buf, '[');
-        for(p = fm_path_get_basename(fi_path); *p; ++p)
-        {
-            switch(*p)
-            {
-            case '\r':
-                g_string_append(buf, "\\r");
-                break;
-            case '\n':
-                g_string_append(buf, "\\n");
-                break;
-            case '\\':
-                g_string_append(buf, "\\\\");
-                break;
-            case '[':
-                g_string_append(buf, "\\[");
-                break;
-            case ']':
-                g_string_append(buf, "\\]");
-                break;
-            default:
-                g_string_append_c(buf, *p);
-            }
-        }
-        g_string_append(buf, "]\n");
-        g_string_append_printf(buf, "x=%d\n"
-                                    "y=%d\n\n",
-                                    item->area.x, item->area.y);
-    }
     g_file_set_contents(path, buf->str, buf->len, NULL);
     g_free(path);
     g_string_free(buf, TRUE);
@@ -454,8 +874,12 @@ static gboolean on_config_save_idle(gpointer _unused)
         return FALSE;
 
     for (i = 0; i < n_screens; i++)
+    {
         if (desktops[i]->conf.changed)
+            save_config(desktops[i]);
+        if (desktops[i]->pos_changed)
             save_item_pos(desktops[i]);
+    }
     idle_config_save = 0;
     return FALSE;
 }
@@ -468,6 +892,13 @@ static void queue_config_save(FmDesktop *desktop)
         idle_config_save = gdk_threads_add_idle(on_config_save_idle, NULL);
 }
 
+static void queue_item_pos_save(FmDesktop *desktop)
+{
+    desktop->pos_changed = TRUE;
+    if (idle_config_save == 0)
+        idle_config_save = gdk_threads_add_idle(on_config_save_idle, NULL);
+}
+
 static GList* get_selected_items(FmDesktop* desktop, int* n_items)
 {
     GList* items = NULL;
@@ -777,6 +1208,7 @@ static FmDesktopExtraItem *_add_extra_item(const char *path_str)
 
 static void set_focused_item(FmDesktop* desktop, FmDesktopItem* item);
 static inline gint fm_desktop_accessible_index(GtkWidget *desktop, gpointer item);
+static void fm_desktop_item_selected_changed(FmDesktop *desktop, FmDesktopItem *item);
 
 /* ---- accessible item mirror ---- */
 typedef struct _FmDesktopItemAccessible FmDesktopItemAccessible;
@@ -1057,7 +1489,7 @@ static gint fm_desktop_item_accessible_get_index_in_parent(AtkObject *obj)
 {
     FmDesktopItemAccessible *item = FM_DESKTOP_ITEM_ACCESSIBLE(obj);
 
-    return item->widget ? fm_desktop_accessible_index(item->widget, item) : -1;
+    return item->widget ? fm_desktop_accessible_index(item->widget, item->item) : -1;
 }
 
 static AtkStateSet *fm_desktop_item_accessible_ref_state_set(AtkObject *obj)
@@ -1122,8 +1554,9 @@ static GType fm_desktop_accessible_get_type (void);
 typedef struct _FmDesktopAccessiblePriv FmDesktopAccessiblePriv;
 struct _FmDesktopAccessiblePriv
 {
-    /* we don't catch model index but have own index in items list instead */
-    GList *items;
+    /* item accessibles are created only when requested, the index of item
+       in parent is the index of its row in the model */
+    GHashTable *items; /* FmDesktopItem -> FmDesktopItemAccessible */
     guint action_idle_handler;
 };
 
@@ -1178,16 +1611,57 @@ GType fm_desktop_accessible_get_type(void)
     return type_id_volatile;
 }
 
-static inline GList *fm_desktop_find_accessible_for_item(FmDesktopAccessiblePriv *priv, FmDesktopItem *item)
+/* returns accessible for item, creates it if create is TRUE */
+static FmDesktopItemAccessible *fm_desktop_find_accessible_for_item(AtkObject *obj,
+                                                                    FmDesktopItem *item,
+                                                                    gboolean create)
+{
+    FmDesktopAccessiblePriv *priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
+    GtkWidget *widget = gtk_accessible_get_widget(GTK_ACCESSIBLE(obj));
+    FmDesktopItemAccessible *item_atk;
+
+    item_atk = g_hash_table_lookup(priv->items, item);
+    if (item_atk == NULL && create && widget != NULL)
+    {
+        item_atk = fm_desktop_item_accessible_new(FM_DESKTOP(widget), item);
+        g_hash_table_insert(priv->items, item, item_atk);
+    }
+    return item_atk;
+}
+
+/* returns item in model row index */
+static FmDesktopItem *fm_desktop_accessible_nth_item(AtkObject *obj, gint index)
 {
-    GList *items = priv->items;
+    GtkWidget *widget = gtk_accessible_get_widget(GTK_ACCESSIBLE(obj));
+    FmDesktop *desktop;
+    GtkTreeIter it;
+
+    if (widget == NULL || index < 0)
+        return NULL;
+    desktop = FM_DESKTOP(widget);
+    if (desktop->model == NULL ||
+        !gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(desktop->model), &it, NULL, index))
+        return NULL;
+    return fm_folder_model_get_item_userdata(desktop->model, &it);
+}
+
+/* returns index-th selected item in model order */
+static FmDesktopItem *fm_desktop_accessible_nth_selected(FmDesktop *desktop, gint index)
+{
+    GtkTreeModel *model;
+    FmDesktopItem *item;
+    GtkTreeIter it;
 
-    while (items)
+    if (desktop->model == NULL || index < 0 || index >= (gint)desktop->selected.length)
+        return NULL;
+    model = GTK_TREE_MODEL(desktop->model);
+    if (gtk_tree_model_get_iter_first(model, &it)) do
     {
-        if (((FmDesktopItemAccessible *)items->data)->item == item)
-            return items;
-        items = items->next;
+        item = fm_folder_model_get_item_userdata(desktop->model, &it);
+        if (item->is_selected && index-- == 0)
+            return item;
     }
+    while (gtk_tree_model_iter_next(model, &it));
     return NULL;
 }
 
@@ -1200,7 +1674,6 @@ static AtkObject *fm_desktop_accessible_ref_accessible_at_point(AtkComponent *co
     FmDesktop *desktop;
     gint x_pos, y_pos;
     FmDesktopItem *item;
-    GList *obj_l = NULL;
     GtkTreeIter it;
 
     if (widget == NULL)
@@ -1209,9 +1682,8 @@ static AtkObject *fm_desktop_accessible_ref_accessible_at_point(AtkComponent *co
     atk_component_get_extents(component, &x_pos, &y_pos, NULL, NULL, coord_type);
     item = hit_test(desktop, &it, x - x_pos, y - y_pos);
     if (item)
-        obj_l = fm_desktop_find_accessible_for_item(FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(component), item);
-    if (obj_l)
-        return g_object_ref(obj_l->data);
+        return g_object_ref(fm_desktop_find_accessible_for_item(ATK_OBJECT(component),
+                                                                item, TRUE));
     return NULL;
 }
 
@@ -1224,20 +1696,18 @@ static gboolean fm_desktop_accessible_add_selection(AtkSelection *selection, gin
 {
     GtkWidget *widget = gtk_accessible_get_widget(GTK_ACCESSIBLE(selection));
     FmDesktop *desktop;
-    FmDesktopAccessiblePriv *priv;
-    FmDesktopItemAccessible *item;
+    FmDesktopItem *item;
 
     if (widget == NULL)
         return FALSE;
 
     desktop = FM_DESKTOP(widget);
-    priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(selection);
-    item = g_list_nth_data(priv->items, i);
+    item = fm_desktop_accessible_nth_item(ATK_OBJECT(selection), i);
     if (!item)
         return FALSE;
-    item->item->is_selected = TRUE;
-    redraw_item(desktop, item->item);
-    atk_object_notify_state_change(ATK_OBJECT(item), ATK_STATE_SELECTED, TRUE);
+    set_item_selected(desktop, item, TRUE);
+    redraw_item(desktop, item);
+    fm_desktop_item_selected_changed(desktop, item);
     return TRUE;
 }
 
@@ -1255,49 +1725,35 @@ static gboolean fm_desktop_accessible_clear_selection(AtkSelection *selection)
 static AtkObject *fm_desktop_accessible_ref_selection(AtkSelection *selection,
                                                       gint i)
 {
-    FmDesktopAccessiblePriv *priv;
-    FmDesktopItemAccessible *item;
-    GList *items;
+    GtkWidget *widget = gtk_accessible_get_widget(GTK_ACCESSIBLE(selection));
+    FmDesktopItem *item;
 
-    if (i < 0)
+    if (widget == NULL)
         return NULL;
-
-    priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(selection);
-    for (items = priv->items; items; items = items->next)
-    {
-        item = items->data;
-        if (item->item->is_selected)
-            if (i-- == 0)
-                return (AtkObject *)g_object_ref(item);
-    }
-    return NULL;
-}
+    item = fm_desktop_accessible_nth_selected(FM_DESKTOP(widget), i);
+    if (item == NULL)
+        return NULL;
+    return g_object_ref(fm_desktop_find_accessible_for_item(ATK_OBJECT(selection),
+                                                            item, TRUE));
+}
 
 static gint fm_desktop_accessible_get_selection_count(AtkSelection *selection)
 {
-    FmDesktopAccessiblePriv *priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(selection);
-    FmDesktopItemAccessible *item;
-    GList *items;
-    gint i = 0;
+    GtkWidget *widget = gtk_accessible_get_widget(GTK_ACCESSIBLE(selection));
 
-    for (items = priv->items; items; items = items->next)
-    {
-        item = items->data;
-        if (item->item->is_selected)
-            i++;
-    }
-    return i;
+    if (widget == NULL)
+        return 0;
+    return FM_DESKTOP(widget)->selected.length;
 }
 
 static gboolean fm_desktop_accessible_is_child_selected(AtkSelection *selection,
                                                         gint i)
 {
-    FmDesktopAccessiblePriv *priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(selection);
-    FmDesktopItemAccessible *item = g_list_nth_data(priv->items, i);
+    FmDesktopItem *item = fm_desktop_accessible_nth_item(ATK_OBJECT(selection), i);
 
     if (item == NULL)
         return FALSE;
-    return item->item->is_selected;
+    return item->is_selected;
 }
 
 static gboolean fm_desktop_accessible_remove_selection(AtkSelection *selection,
@@ -1305,30 +1761,19 @@ static gboolean fm_desktop_accessible_remove_selection(AtkSelection *selection,
 {
     GtkWidget *widget = gtk_accessible_get_widget(GTK_ACCESSIBLE(selection));
     FmDesktop *desktop;
-    FmDesktopAccessiblePriv *priv;
-    FmDesktopItemAccessible *item;
-    GList *items;
+    FmDesktopItem *item;
 
-    if (i < 0)
-        return FALSE;
     if (widget == NULL)
         return FALSE;
     desktop = FM_DESKTOP(widget);
 
-    priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(selection);
-    for (items = priv->items; items; items = items->next)
-    {
-        item = items->data;
-        if (item->item->is_selected)
-            if (i-- == 0)
-            {
-                item->item->is_selected = FALSE;
-                redraw_item(desktop, item->item);
-                atk_object_notify_state_change(ATK_OBJECT(item), ATK_STATE_SELECTED, FALSE);
-                return TRUE;
-            }
-    }
-    return FALSE;
+    item = fm_desktop_accessible_nth_selected(desktop, i);
+    if (item == NULL)
+        return FALSE;
+    set_item_selected(desktop, item, FALSE);
+    redraw_item(desktop, item);
+    fm_desktop_item_selected_changed(desktop, item);
+    return TRUE;
 }
 
 static gboolean fm_desktop_accessible_select_all_selection(AtkSelection *selection)
@@ -1416,17 +1861,15 @@ static void fm_desktop_accessible_finalize(GObject *object)
 {
     FmDesktopAccessiblePriv *priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(object);
     FmDesktopItemAccessible *item;
+    GHashTableIter iter;
 
-    /* FIXME: should we g_assert(priv->items) here instead? */
-    while (priv->items)
+    g_hash_table_iter_init(&iter, priv->items);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&item))
     {
-        item = priv->items->data;
         item->item = NULL;
         fm_desktop_item_accessible_add_state(item, ATK_STATE_DEFUNCT);
-        g_signal_emit_by_name(item, "children-changed::remove", 0, NULL, NULL);
-        priv->items = g_list_remove_link(priv->items, priv->items);
-        g_object_unref(item);
     }
+    g_hash_table_destroy(priv->items);
     if (priv->action_idle_handler)
     {
         g_source_remove(priv->action_idle_handler);
@@ -1437,31 +1880,34 @@ static void fm_desktop_accessible_finalize(GObject *object)
 
 static gint fm_desktop_accessible_get_n_children(AtkObject *accessible)
 {
-    FmDesktopAccessiblePriv *priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(accessible);
+    GtkWidget *widget = gtk_accessible_get_widget(GTK_ACCESSIBLE(accessible));
+    FmDesktop *desktop;
 
-    return g_list_length(priv->items);
+    if (widget == NULL)
+        return 0;
+    desktop = FM_DESKTOP(widget);
+    if (desktop->model == NULL)
+        return 0;
+    return gtk_tree_model_iter_n_children(GTK_TREE_MODEL(desktop->model), NULL);
 }
 
 static AtkObject *fm_desktop_accessible_ref_child(AtkObject *accessible,
                                                   gint index)
 {
-    FmDesktopAccessiblePriv *priv;
-    FmDesktopItemAccessible *item;
+    FmDesktopItem *item = fm_desktop_accessible_nth_item(accessible, index);
 
-    if (index < 0)
-        return NULL;
-
-    priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(accessible);
-    item = g_list_nth_data(priv->items, index);
     if (!item)
         return NULL;
-    return (AtkObject *)g_object_ref(item);
+    return g_object_ref(fm_desktop_find_accessible_for_item(accessible, item, TRUE));
 }
 
 static void fm_desktop_accessible_initialize(AtkObject *accessible, gpointer data)
 {
     if (ATK_OBJECT_CLASS(fm_desktop_accessible_parent_class)->initialize)
         ATK_OBJECT_CLASS(fm_desktop_accessible_parent_class)->initialize(accessible, data);
+    /* let desktop notify it without creating it if there is none */
+    FM_DESKTOP(data)->accessible = accessible;
+    g_object_add_weak_pointer(G_OBJECT(accessible), (gpointer *)&FM_DESKTOP(data)->accessible);
     atk_object_set_role(accessible, ATK_ROLE_WINDOW);
     /* FIXME: set name by monitor */
     atk_object_set_name(accessible, _("Desktop"));
@@ -1471,7 +1917,8 @@ static void fm_desktop_accessible_init(FmDesktopAccessible *object)
 {
     FmDesktopAccessiblePriv *priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(object);
 
-    priv->items = NULL;
+    priv->items = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                        NULL, g_object_unref);
 }
 
 static void fm_desktop_accessible_class_init(FmDesktopAccessibleClass *klass)
@@ -1541,594 +1988,1844 @@ static AtkObject *fm_desktop_get_accessible(GtkWidget *widget)
 
 static inline gint fm_desktop_accessible_index(GtkWidget *desktop, gpointer item)
 {
-    AtkObject *desktop_atk = gtk_widget_get_accessible(desktop);
-    FmDesktopAccessiblePriv *priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(desktop_atk);
+    FmDesktop *self = FM_DESKTOP(desktop);
+    GtkTreePath *tp;
+    gint index = -1;
 
-    return g_list_index(priv->items, item);
+    if (item == NULL || self->model == NULL)
+        return -1;
+    tp = gtk_tree_model_get_path(GTK_TREE_MODEL(self->model), &((FmDesktopItem *)item)->it);
+    if (tp)
+    {
+        index = gtk_tree_path_get_indices(tp)[0];
+        gtk_tree_path_free(tp);
+    }
+    return index;
 }
 
-static void fm_desktop_accessible_item_deleted(FmDesktop *desktop, FmDesktopItem *item)
+/* desktop->accessible is set only if ATK asked for it, otherwise there is
+   nothing to notify and no item accessibles exist */
+static void fm_desktop_accessible_item_deleted(FmDesktop *desktop, FmDesktopItem *item,
+                                               gint index)
 {
-    AtkObject *obj;
+    AtkObject *obj = desktop->accessible;
     FmDesktopAccessiblePriv *priv;
-    GList *item_atk_l;
     FmDesktopItemAccessible *item_atk;
-    gint index;
 
-    obj = gtk_widget_get_accessible(GTK_WIDGET(desktop));
-    if (obj != NULL && FM_IS_DESKTOP_ACCESSIBLE(obj))
+    if (obj == NULL)
+        return;
+    priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
+    item_atk = g_hash_table_lookup(priv->items, item);
+    if (item_atk)
     {
-        priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
-        item_atk_l = fm_desktop_find_accessible_for_item(priv, item);
-        g_return_if_fail(item_atk_l != NULL);
-        item_atk = item_atk_l->data;
         item_atk->item = NULL;
-        index = g_list_position(priv->items, item_atk_l);
         fm_desktop_item_accessible_add_state(item_atk, ATK_STATE_DEFUNCT);
-        g_signal_emit_by_name(obj, "children-changed::remove", index, NULL, NULL);
-        priv->items = g_list_remove_link(priv->items, item_atk_l);
-        g_object_unref(item_atk);
     }
+    g_signal_emit_by_name(obj, "children-changed::remove", index, item_atk, NULL);
+    if (item_atk)
+        g_hash_table_remove(priv->items, item);
 }
 
 static void fm_desktop_accessible_item_added(FmDesktop *desktop, FmDesktopItem *item,
                                              guint index)
 {
-    AtkObject *obj;
-    FmDesktopAccessiblePriv *priv;
-    FmDesktopItemAccessible *item_atk;
-
-    obj = gtk_widget_get_accessible(GTK_WIDGET(desktop));
-    if (obj != NULL && FM_IS_DESKTOP_ACCESSIBLE(obj))
-    {
-        priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
-        item_atk = fm_desktop_item_accessible_new(desktop, item);
-        g_warn_if_fail(index <= g_list_length(priv->items));
-        priv->items = g_list_insert(priv->items, g_object_ref(item_atk), index);
-        g_signal_emit_by_name(obj, "children-changed::add", index, NULL, NULL);
-    }
-}
-
-static void fm_desktop_accessible_items_reordered(FmDesktop *desktop,
-                                                  GtkTreeModel *model,
-                                                  gint *new_order)
-{
-    AtkObject *obj;
-    FmDesktopAccessiblePriv *priv;
-    GList *new_list = NULL;
-    int length, i;
-
-    obj = gtk_widget_get_accessible(GTK_WIDGET(desktop));
-    if (obj != NULL && FM_IS_DESKTOP_ACCESSIBLE(obj))
-    {
-        priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
-        length = gtk_tree_model_iter_n_children(model, NULL);
-        g_return_if_fail(length == (gint)g_list_length(priv->items));
-        for (i = 0; i < length; i++)
-        {
-            g_assert(new_order[i] >= 0 && new_order[i] < length);
-            new_list = g_list_prepend(new_list,
-                                      g_list_nth_data(priv->items, new_order[i]));
-        }
-        g_list_free(priv->items);
-        priv->items = g_list_reverse(new_list);
-    }
+    if (desktop->accessible)
+        g_signal_emit_by_name(desktop->accessible, "children-changed::add",
+                              index, NULL, NULL);
 }
 
 static void fm_desktop_item_selected_changed(FmDesktop *desktop, FmDesktopItem *item)
 {
-    AtkObject *obj;
-    FmDesktopAccessiblePriv *priv;
-    GList *item_atk_l;
+    FmDesktopItemAccessible *item_atk;
 
-    obj = gtk_widget_get_accessible(GTK_WIDGET(desktop));
-    if (obj != NULL && FM_IS_DESKTOP_ACCESSIBLE(obj))
-    {
-        priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
-        item_atk_l = fm_desktop_find_accessible_for_item(priv, item);
-        g_return_if_fail(item_atk_l != NULL);
-        atk_object_notify_state_change(item_atk_l->data, ATK_STATE_SELECTED,
+    if (desktop->accessible == NULL)
+        return;
+    item_atk = fm_desktop_find_accessible_for_item(desktop->accessible, item, FALSE);
+    if (item_atk)
+        atk_object_notify_state_change(ATK_OBJECT(item_atk), ATK_STATE_SELECTED,
                                        item->is_selected);
-    }
 }
 
 static void fm_desktop_accessible_focus_set(FmDesktop *desktop, FmDesktopItem *item)
 {
-    AtkObject *obj;
-    FmDesktopAccessiblePriv *priv;
-    GList *item_atk_l;
+    FmDesktopItemAccessible *item_atk;
 
-    obj = gtk_widget_get_accessible(GTK_WIDGET(desktop));
-    if (obj != NULL && FM_IS_DESKTOP_ACCESSIBLE(obj))
-    {
-        priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
-        item_atk_l = fm_desktop_find_accessible_for_item(priv, item);
-        g_return_if_fail(item_atk_l != NULL);
-        atk_object_notify_state_change(item_atk_l->data, ATK_STATE_FOCUSED, TRUE);
-    }
+    /* focused item is the one AT would ask about so create it now */
+    if (desktop->accessible == NULL)
+        return;
+    item_atk = fm_desktop_find_accessible_for_item(desktop->accessible, item, TRUE);
+    if (item_atk)
+        atk_object_notify_state_change(ATK_OBJECT(item_atk), ATK_STATE_FOCUSED, TRUE);
 }
 
 static void fm_desktop_accessible_focus_unset(FmDesktop *desktop, FmDesktopItem *item)
 {
-    AtkObject *obj;
-    FmDesktopAccessiblePriv *priv;
-    GList *item_atk_l;
+    FmDesktopItemAccessible *item_atk;
 
-    obj = gtk_widget_get_accessible(GTK_WIDGET(desktop));
-    if (obj != NULL && FM_IS_DESKTOP_ACCESSIBLE(obj))
-    {
-        priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
-        item_atk_l = fm_desktop_find_accessible_for_item(priv, item);
-        g_return_if_fail(item_atk_l != NULL);
-        atk_object_notify_state_change(item_atk_l->data, ATK_STATE_FOCUSED, FALSE);
-    }
+    if (desktop->accessible == NULL)
+        return;
+    item_atk = fm_desktop_find_accessible_for_item(desktop->accessible, item, FALSE);
+    if (item_atk)
+        atk_object_notify_state_change(ATK_OBJECT(item_atk), ATK_STATE_FOCUSED, FALSE);
 }
 
+/* should be called while model is still set */
 static void fm_desktop_accessible_model_removed(FmDesktop *desktop)
 {
-    AtkObject *obj;
+    AtkObject *obj = desktop->accessible;
     FmDesktopAccessiblePriv *priv;
     FmDesktopItemAccessible *item_atk;
+    GHashTableIter iter;
+    gint n;
 
-    obj = gtk_widget_get_accessible(GTK_WIDGET(desktop));
-    if (obj != NULL && FM_IS_DESKTOP_ACCESSIBLE(obj))
+    if (obj == NULL)
+        return;
+    priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
+    g_hash_table_iter_init(&iter, priv->items);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&item_atk))
     {
-        priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
-        while (priv->items)
-        {
-            item_atk = priv->items->data;
-            item_atk->item = NULL;
-            fm_desktop_item_accessible_add_state(item_atk, ATK_STATE_DEFUNCT);
-            g_signal_emit_by_name(obj, "children-changed::remove", 0, NULL, NULL);
-            priv->items = g_list_remove_link(priv->items, priv->items);
-            g_object_unref(item_atk);
-        }
+        item_atk->item = NULL;
+        fm_desktop_item_accessible_add_state(item_atk, ATK_STATE_DEFUNCT);
     }
+    g_hash_table_remove_all(priv->items);
+    n = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(desktop->model), NULL);
+    while (n > 0)
+        g_signal_emit_by_name(obj, "children-changed::remove", --n, NULL, NULL);
 }
 
 
 /* ---------------------------------------------------------------------
-    Desktop drawing */
+    Spatial index of items
+
+   The working area is split into buckets of cell size and each item is
+   linked into every bucket its rectangle overlaps, so a lookup by point
+   or by rectangle visits only items around that place instead of the
+   whole model. Coordinates out of the working area are clamped to the
+   border buckets so items pushed out of the screen are still found. */
 
 static inline void get_item_rect(FmDesktopItem* item, GdkRectangle* rect)
 {
     gdk_rectangle_union(&item->icon_rect, &item->text_rect, rect);
 }
 
-static gboolean is_pos_occupied(FmDesktop* desktop, FmDesktopItem* item)
+static inline guint _grid_col(FmDesktopGrid *grid, gint x)
 {
-    GList* l;
-    for(l = desktop->fixed_items; l; l=l->next)
-    {
-        FmDesktopItem* fixed = (FmDesktopItem*)l->data;
-        GdkRectangle rect;
-        get_item_rect(fixed, &rect);
-        if(gdk_rectangle_intersect(&rect, &item->icon_rect, NULL)
-         ||gdk_rectangle_intersect(&rect, &item->text_rect, NULL))
-            return TRUE;
-    }
-    return FALSE;
+    if (x <= grid->x)
+        return 0;
+    return MIN((guint)(x - grid->x) / grid->bucket_w, grid->cols - 1);
 }
 
-static void layout_items(FmDesktop* self)
+static inline guint _grid_row(FmDesktopGrid *grid, gint y)
 {
-    FmDesktopItem* item;
-    GtkTreeModel* model = self->model ? GTK_TREE_MODEL(self->model) : NULL;
-    GdkPixbuf* icon;
-    GtkTreeIter it;
-    int x, y, bottom;
-    GtkTextDirection direction = gtk_widget_get_direction(GTK_WIDGET(self));
+    if (y <= grid->y)
+        return 0;
+    return MIN((guint)(y - grid->y) / grid->bucket_h, grid->rows - 1);
+}
 
-    y = self->ymargin;
-    bottom = self->working_area.height - self->ymargin;
+static void desktop_grid_remove(FmDesktop *desktop, FmDesktopItem *item)
+{
+    FmDesktopGrid *grid = desktop->grid;
+    guint c, r;
 
-    if(!model || !gtk_tree_model_get_iter_first(model, &it))
-    {
-        gtk_widget_queue_draw(GTK_WIDGET(self));
+    if (!item->in_grid)
         return;
-    }
-    if(direction != GTK_TEXT_DIR_RTL) /* LTR or NONE */
-    {
-        x = self->xmargin;
-        do
+    for (r = item->grid_y1; r <= item->grid_y2; r++)
+        for (c = item->grid_x1; c <= item->grid_x2; c++)
         {
-            item = fm_folder_model_get_item_userdata(self->model, &it);
-            icon = NULL;
-            gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
-            if(item->fixed_pos)
-                calc_item_size(self, item, icon);
-            else
-            {
-_next_position:
-                item->area.x = self->working_area.x + x;
-                item->area.y = self->working_area.y + y;
-                calc_item_size(self, item, icon);
-                /* check if item does not fit into space that left */
-                if (item->area.y + item->area.height > bottom && y > self->ymargin)
-                {
-                    x += self->cell_w;
-                    y = self->ymargin;
-                    goto _next_position;
-                }
-                /* prepare position for next item */
-                while (self->working_area.y + y < item->area.y + item->area.height)
-                    y += self->cell_h;
-                /* check if this position is occupied by a fixed item */
-                if(is_pos_occupied(self, item))
-                    goto _next_position;
-            }
-            if(icon)
-                g_object_unref(icon);
+            GSList **bucket = &grid->buckets[r * grid->cols + c];
+            *bucket = g_slist_remove(*bucket, item);
         }
-        while(gtk_tree_model_iter_next(model, &it));
-    }
-    else /* RTL */
-    {
-        x = self->working_area.width - self->xmargin - self->cell_w;
-        do
+    item->in_grid = FALSE;
+}
+
+/* (re)links item into the index according to its current rectangles */
+static void desktop_grid_update(FmDesktop *desktop, FmDesktopItem *item)
+{
+    FmDesktopGrid *grid = desktop->grid;
+    GdkRectangle rect;
+    guint c, r;
+
+    if (grid == NULL || grid->buckets == NULL)
+        return;
+    desktop_grid_remove(desktop, item);
+    get_item_rect(item, &rect);
+    item->grid_x1 = _grid_col(grid, rect.x);
+    item->grid_y1 = _grid_row(grid, rect.y);
+    item->grid_x2 = _grid_col(grid, rect.x + MAX(rect.width, 1) - 1);
+    item->grid_y2 = _grid_row(grid, rect.y + MAX(rect.height, 1) - 1);
+    for (r = item->grid_y1; r <= item->grid_y2; r++)
+        for (c = item->grid_x1; c <= item->grid_x2; c++)
         {
-            item = fm_folder_model_get_item_userdata(self->model, &it);
-            icon = NULL;
-            gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
-            if(item->fixed_pos)
-                calc_item_size(self, item, icon);
-            else
-            {
-_next_position_rtl:
-                item->area.x = self->working_area.x + x;
-                item->area.y = self->working_area.y + y;
-                calc_item_size(self, item, icon);
-                /* check if item does not fit into space that left */
-                if (item->area.y + item->area.height > bottom && y > self->ymargin)
-                {
-                    x -= self->cell_w;
-                    y = self->ymargin;
-                    goto _next_position_rtl;
-                }
-                /* prepare position for next item */
-                while (self->working_area.y + y < item->area.y + item->area.height)
-                    y += self->cell_h;
-                /* check if this position is occupied by a fixed item */
-                if(is_pos_occupied(self, item))
-                    goto _next_position_rtl;
-            }
-            if(icon)
-                g_object_unref(icon);
+            GSList **bucket = &grid->buckets[r * grid->cols + c];
+            *bucket = g_slist_prepend(*bucket, item);
         }
-        while(gtk_tree_model_iter_next(model, &it));
+    item->in_grid = TRUE;
+}
+
+static void desktop_grid_clear(FmDesktop *desktop)
+{
+    FmDesktopGrid *grid = desktop->grid;
+    GSList *l;
+    guint i;
+
+    if (grid == NULL || grid->buckets == NULL)
+        return;
+    for (i = 0; i < grid->cols * grid->rows; i++)
+    {
+        for (l = grid->buckets[i]; l; l = l->next)
+            ((FmDesktopItem*)l->data)->in_grid = FALSE;
+        g_slist_free(grid->buckets[i]);
+        grid->buckets[i] = NULL;
     }
-    gtk_widget_queue_draw(GTK_WIDGET(self));
 }
 
-static gboolean on_idle_layout(FmDesktop* desktop)
+/* empties the index and adapts it to current working area and cell size */
+static void desktop_grid_reset(FmDesktop *desktop)
 {
-    desktop->idle_layout = 0;
-    desktop->layout_pending = FALSE;
-    layout_items(desktop);
-    return FALSE;
+    FmDesktopGrid *grid = desktop->grid;
+    guint cols, rows;
+
+    if (grid == NULL)
+        grid = desktop->grid = g_slice_new0(FmDesktopGrid);
+    else
+        desktop_grid_clear(desktop);
+    grid->x = desktop->working_area.x;
+    grid->y = desktop->working_area.y;
+    grid->bucket_w = MAX(desktop->cell_w, 16);
+    grid->bucket_h = MAX(desktop->cell_h, 16);
+    cols = MAX(1, (desktop->working_area.width + grid->bucket_w - 1) / grid->bucket_w);
+    rows = MAX(1, (desktop->working_area.height + grid->bucket_h - 1) / grid->bucket_h);
+    /* bucket ranges of items are kept in 16 bits */
+    cols = MIN(cols, G_MAXUINT16);
+    rows = MIN(rows, G_MAXUINT16);
+    if (cols != grid->cols || rows != grid->rows)
+    {
+        g_free(grid->buckets);
+        grid->buckets = g_new0(GSList*, cols * rows);
+        grid->cols = cols;
+        grid->rows = rows;
+    }
 }
 
-static void queue_layout_items(FmDesktop* desktop)
+static void desktop_grid_free(FmDesktop *desktop)
 {
-    /* don't try to layout items until config is loaded,
-       this may be cause of the bug #927 on SF.net */
-    if (!gtk_widget_get_realized(GTK_WIDGET(desktop)))
-        desktop->layout_pending = TRUE;
-    else if (0 == desktop->idle_layout)
-        desktop->idle_layout = gdk_threads_add_idle((GSourceFunc)on_idle_layout, desktop);
+    if (desktop->grid == NULL)
+        return;
+    desktop_grid_clear(desktop);
+    g_free(desktop->grid->buckets);
+    g_slice_free(FmDesktopGrid, desktop->grid);
+    desktop->grid = NULL;
 }
 
-static void paint_item(FmDesktop* self, FmDesktopItem* item, cairo_t* cr, GdkRectangle* expose_area, GdkPixbuf* icon)
+typedef void (*FmDesktopGridFunc)(FmDesktop *desktop, FmDesktopItem *item, gpointer user_data);
+
+/* calls func once for each item which may intersect any of rects */
+static void desktop_grid_foreach(FmDesktop *desktop, const GdkRectangle *rects,
+                                 guint n_rects, FmDesktopGridFunc func,
+                                 gpointer user_data)
 {
-#if GTK_CHECK_VERSION(3, 0, 0)
-    GtkStyleContext* style;
-#else
-    GtkStyle* style;
-#endif
-    GtkWidget* widget = (GtkWidget*)self;
-    GtkCellRendererState state = 0;
-#if GTK_CHECK_VERSION(3, 0, 0)
-    GdkRGBA rgba;
-#else
-    GdkWindow* window;
-#endif
-    int text_x, text_y;
+    FmDesktopGrid *grid = desktop->grid;
+    guint c, r, c2, r2, i;
+    GSList *l;
 
-    /* don't draw dragged items on desktop, they are moved with mouse */
-    if (item->is_selected && self->dragging)
+    if (grid == NULL || grid->buckets == NULL)
         return;
+    if (++grid->stamp == 0) /* wrapped around, make sure no item has it */
+    {
+        for (i = 0; i < grid->cols * grid->rows; i++)
+            for (l = grid->buckets[i]; l; l = l->next)
+                ((FmDesktopItem*)l->data)->grid_stamp = 0;
+        grid->stamp = 1;
+    }
+    for (i = 0; i < n_rects; i++)
+    {
+        if (rects[i].width <= 0 || rects[i].height <= 0)
+            continue;
+        c2 = _grid_col(grid, rects[i].x + rects[i].width - 1);
+        r2 = _grid_row(grid, rects[i].y + rects[i].height - 1);
+        for (r = _grid_row(grid, rects[i].y); r <= r2; r++)
+            for (c = _grid_col(grid, rects[i].x); c <= c2; c++)
+                for (l = grid->buckets[r * grid->cols + c]; l; l = l->next)
+                {
+                    FmDesktopItem *item = l->data;
+                    if (item->grid_stamp == grid->stamp)
+                        continue;
+                    item->grid_stamp = grid->stamp;
+                    func(desktop, item, user_data);
+                }
+    }
+}
 
-#if GTK_CHECK_VERSION(3, 0, 0)
-    style = gtk_widget_get_style_context(widget);
-#else
-    style = gtk_widget_get_style(widget);
-    window = gtk_widget_get_window(widget);
-#endif
+/* returns items linked into bucket containing the point */
+static inline GSList *desktop_grid_lookup(FmDesktop *desktop, gint x, gint y)
+{
+    FmDesktopGrid *grid = desktop->grid;
 
-    pango_layout_set_text(self->pl, NULL, 0);
-    pango_layout_set_width(self->pl, self->pango_text_w);
-    pango_layout_set_height(self->pl, self->pango_text_h);
+    if (grid == NULL || grid->buckets == NULL)
+        return NULL;
+    return grid->buckets[_grid_row(grid, y) * grid->cols + _grid_col(grid, x)];
+}
 
-    pango_layout_set_text(self->pl, fm_file_info_get_disp_name(item->fi), -1);
 
-    /* FIXME: do we need to cache this? */
-    text_x = item->area.x + (self->cell_w - self->text_w)/2 + 2;
-    text_y = item->text_rect.y + 2;
+/* ---------------------------------------------------------------------
+    Desktop drawing */
 
-    if(item->is_selected || item == self->drop_hilight) /* draw background for text label */
-    {
-        state = GTK_CELL_RENDERER_SELECTED;
+/* occupancy map of layout slots, each slot lists fixed items which overlap
+   it; slots are counted from the side where layout starts */
+typedef struct
+{
+    GSList **slots;
+    gint x0; /* left edge for LTR, right edge for RTL */
+    gint y0;
+    gint cell_w, cell_h;
+    gint cols, rows;
+    gboolean rtl;
+} FmDesktopOccupancy;
 
-        cairo_save(cr);
-        gdk_cairo_rectangle(cr, &item->text_rect);
-#if GTK_CHECK_VERSION(3, 0, 0)
-        gtk_style_context_get_background_color(style, GTK_STATE_FLAG_SELECTED, &rgba);
-        gdk_cairo_set_source_rgba(cr, &rgba);
-#else
-        gdk_cairo_set_source_color(cr, &style->bg[GTK_STATE_SELECTED]);
-#endif
-        cairo_clip(cr);
-        cairo_paint(cr);
-        cairo_restore(cr);
-#if GTK_CHECK_VERSION(3, 0, 0)
-        gtk_style_context_get_color(style, GTK_STATE_FLAG_SELECTED, &rgba);
-        gdk_cairo_set_source_rgba(cr, &rgba);
-#else
-        gdk_cairo_set_source_color(cr, &style->fg[GTK_STATE_SELECTED]);
-#endif
-    }
-    else
-    {
-        /* the shadow */
-        gdk_cairo_set_source_color(cr, &self->conf.desktop_shadow);
-        cairo_move_to(cr, text_x + 1, text_y + 1);
-        pango_cairo_show_layout(cr, self->pl);
-        gdk_cairo_set_source_color(cr, &self->conf.desktop_fg);
-    }
-    /* real text */
-    cairo_move_to(cr, text_x, text_y);
-    /* FIXME: should we check if pango is 1.10 at least? */
-    pango_cairo_show_layout(cr, self->pl);
-    pango_layout_set_text(self->pl, NULL, 0);
+static inline gint _occupancy_col(FmDesktopOccupancy *occ, gint x)
+{
+    gint d = occ->rtl ? occ->x0 - 1 - x : x - occ->x0;
+    return d > 0 ? d / occ->cell_w : 0;
+}
 
-    if(item == self->focus && gtk_widget_has_focus(widget))
-#if GTK_CHECK_VERSION(3, 0, 0)
-        gtk_render_focus(style, cr,
-#else
-        gtk_paint_focus(style, window, gtk_widget_get_state(widget),
-                        expose_area, widget, "icon_view",
-#endif
-                        item->text_rect.x, item->text_rect.y, item->text_rect.width, item->text_rect.height);
+static inline gint _occupancy_row(FmDesktopOccupancy *occ, gint y)
+{
+    gint d = y - occ->y0;
+    return d > 0 ? d / occ->cell_h : 0;
+}
+
+/* converts rectangle into range of slots it overlaps */
+static void _occupancy_range(FmDesktopOccupancy *occ, GdkRectangle *rect,
+                             gint *c1, gint *r1, gint *c2, gint *r2)
+{
+    gint left = _occupancy_col(occ, rect->x);
+    gint right = _occupancy_col(occ, rect->x + MAX(rect->width, 1) - 1);
 
-    if(item == self->hover_item) /* hovered */
-        g_object_set(G_OBJECT(self), "tooltip-text", fm_file_info_get_disp_name(item->fi), NULL);
+    *c1 = MIN(left, right);
+    *c2 = MAX(left, right);
+    *r1 = _occupancy_row(occ, rect->y);
+    *r2 = _occupancy_row(occ, rect->y + MAX(rect->height, 1) - 1);
+}
+
+static void occupancy_init(FmDesktop *desktop, FmDesktopOccupancy *occ,
+                           gboolean rtl)
+{
+    GdkRectangle rect;
+    GList *l;
+    gint c1, r1, c2, r2, c, r;
+
+    occ->rtl = rtl;
+    occ->cell_w = MAX(desktop->cell_w, 1);
+    occ->cell_h = MAX(desktop->cell_h, 1);
+    if (rtl)
+        occ->x0 = desktop->working_area.x + desktop->working_area.width - desktop->xmargin;
     else
-        g_object_set(G_OBJECT(self), "tooltip-text", NULL, NULL);
+        occ->x0 = desktop->working_area.x + desktop->xmargin;
+    occ->y0 = desktop->working_area.y + desktop->ymargin;
+    /* the map covers the working area and all fixed items, anything out
+       of it is free */
+    rect = desktop->working_area;
+    _occupancy_range(occ, &rect, &c1, &r1, &c2, &r2);
+    occ->cols = c2 + 1;
+    occ->rows = r2 + 1;
+    for (l = desktop->fixed_items; l; l = l->next)
+    {
+        get_item_rect(l->data, &rect);
+        _occupancy_range(occ, &rect, &c1, &r1, &c2, &r2);
+        occ->cols = MAX(occ->cols, c2 + 1);
+        occ->rows = MAX(occ->rows, r2 + 1);
+    }
+    occ->slots = g_new0(GSList*, occ->cols * occ->rows);
+    for (l = desktop->fixed_items; l; l = l->next)
+    {
+        get_item_rect(l->data, &rect);
+        _occupancy_range(occ, &rect, &c1, &r1, &c2, &r2);
+        for (r = r1; r <= r2; r++)
+            for (c = c1; c <= c2; c++)
+            {
+                GSList **slot = &occ->slots[r * occ->cols + c];
+                *slot = g_slist_prepend(*slot, l->data);
+            }
+    }
+}
 
-    /* draw the icon */
-    g_object_set(self->icon_render, "pixbuf", icon, "info", item->fi, NULL);
-#if GTK_CHECK_VERSION(3, 0, 0)
-    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), cr, widget, &item->icon_rect, &item->icon_rect, state);
-#else
-    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), window, widget, &item->icon_rect, &item->icon_rect, expose_area, state);
-#endif
+static void occupancy_free(FmDesktopOccupancy *occ)
+{
+    gint i;
+
+    for (i = 0; i < occ->cols * occ->rows; i++)
+        g_slist_free(occ->slots[i]);
+    g_free(occ->slots);
 }
 
-static void redraw_item(FmDesktop* desktop, FmDesktopItem* item)
+/* checks if item overlaps any fixed item; only fixed items listed in the
+   slots which item overlaps are tested, the spatial index isn't used here
+   since items out of the working area are all in its border buckets */
+static gboolean is_pos_occupied(FmDesktop* desktop, FmDesktopOccupancy *occ,
+                                FmDesktopItem* item)
 {
     GdkRectangle rect;
+    gint c1, r1, c2, r2, c, r;
+    GSList *l;
+
     get_item_rect(item, &rect);
-    --rect.x;
-    --rect.y;
-    rect.width += 2;
-    rect.height += 2;
-    gdk_window_invalidate_rect(gtk_widget_get_window(GTK_WIDGET(desktop)), &rect, FALSE);
+    _occupancy_range(occ, &rect, &c1, &r1, &c2, &r2);
+    c2 = MIN(c2, occ->cols - 1);
+    r2 = MIN(r2, occ->rows - 1);
+    for (r = r1; r <= r2; r++)
+        for (c = c1; c <= c2; c++)
+            for (l = occ->slots[r * occ->cols + c]; l; l = l->next)
+            {
+                get_item_rect(l->data, &rect);
+                if(gdk_rectangle_intersect(&rect, &item->icon_rect, NULL)
+                 ||gdk_rectangle_intersect(&rect, &item->text_rect, NULL))
+                    return TRUE;
+            }
+    return FALSE;
 }
 
-static void move_item(FmDesktop* desktop, FmDesktopItem* item, int x, int y, gboolean redraw)
+/* moves item rectangles without recalculating its size */
+static inline void shift_item(FmDesktop *desktop, FmDesktopItem *item, int x, int y)
 {
-    int dx, dy;
-    /* this call invalid the area occupied by the item and a redraw
-     * is queued. */
-    if(redraw)
-        redraw_item(desktop, item);
-
-    /* correct coords to put item within working area still */
-    if (x > desktop->working_area.x + desktop->working_area.width - desktop->xmargin - item->area.width)
-        x = desktop->working_area.x + desktop->working_area.width - desktop->xmargin - item->area.width;
-    if (x < desktop->working_area.x + desktop->xmargin)
-        x = desktop->working_area.x + desktop->xmargin;
-    if (y > desktop->working_area.y + desktop->working_area.height - desktop->ymargin - item->area.height)
-        y = desktop->working_area.y + desktop->working_area.height - desktop->ymargin - item->area.height;
-    if (y < desktop->working_area.y + desktop->ymargin)
-        y = desktop->working_area.y + desktop->ymargin;
-
-    dx = x - item->area.x;
-    dy = y - item->area.y;
+    int dx = x - item->area.x;
+    int dy = y - item->area.y;
 
     item->area.x = x;
     item->area.y = y;
-
-    /* calc_item_size(desktop, item); */
     item->icon_rect.x += dx;
     item->icon_rect.y += dy;
     item->text_rect.x += dx;
     item->text_rect.y += dy;
+    if (item->is_selected)
+        desktop->sel_area_valid = FALSE;
+    desktop->nav_valid = FALSE;
+}
 
-    /* make the item use customized fixed position. */
-    if(!item->fixed_pos)
+/* places item into first free slot starting from slot x, y, where x and y
+   are relative to the working area; on return x and y point to the slot
+   where the next item should be tried */
+static void place_item(FmDesktop *self, FmDesktopOccupancy *occ,
+                       FmDesktopItem *item, int *x, int *y, int step)
+{
+    int bottom = self->working_area.height - self->ymargin;
+
+    item->layout_x = *x;
+    item->layout_y = *y;
+    shift_item(self, item, self->working_area.x + *x, self->working_area.y + *y);
+    for(;;)
     {
-        item->fixed_pos = TRUE;
-        desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
+        /* check if item does not fit into space that left */
+        if (item->area.y + item->area.height > bottom && *y > self->ymargin)
+        {
+            *x += step;
+            *y = self->ymargin;
+            shift_item(self, item, self->working_area.x + *x, self->working_area.y + *y);
+            continue;
+        }
+        /* prepare position for next item */
+        while (self->working_area.y + *y < item->area.y + item->area.height)
+            *y += self->cell_h;
+        /* check if this position is occupied by a fixed item */
+        if(!is_pos_occupied(self, occ, item))
+            break;
+        shift_item(self, item, self->working_area.x + *x, self->working_area.y + *y);
     }
+    item->is_placed = TRUE;
+}
 
-    /* move the item to a new place, and queue a redraw for the new rect. */
-    if(redraw)
-        redraw_item(desktop, item);
+static inline int get_layout_step(FmDesktop *self, gboolean rtl, int *x)
+{
+    if(!rtl) /* LTR or NONE */
+    {
+        *x = self->xmargin;
+        return self->cell_w;
+    }
+    *x = self->working_area.width - self->xmargin - self->cell_w;
+    return -(int)self->cell_w;
 }
 
-static void calc_rubber_banding_rect(FmDesktop* self, int x, int y, GdkRectangle* rect)
+static void layout_items(FmDesktop* self)
 {
-    int x1, x2, y1, y2;
-    if(self->drag_start_x < x)
+    FmDesktopItem* item;
+    GtkTreeModel* model = self->model ? GTK_TREE_MODEL(self->model) : NULL;
+    GdkPixbuf* icon;
+    GtkTreeIter it;
+    GList* l;
+    FmDesktopOccupancy occ;
+    int x, y, step;
+    gboolean rtl = (gtk_widget_get_direction(GTK_WIDGET(self)) == GTK_TEXT_DIR_RTL);
+#ifdef G_ENABLE_DEBUG
+    GTimer *timer = g_timer_new();
+    guint n_items = 0;
+#endif
+
+    y = self->ymargin;
+    desktop_grid_reset(self);
+    self->layout_done = (model != NULL);
+
+    if(!model || !gtk_tree_model_get_iter_first(model, &it))
     {
-        x1 = self->drag_start_x;
-        x2 = x;
+#ifdef G_ENABLE_DEBUG
+        g_timer_destroy(timer);
+#endif
+        gtk_widget_queue_draw(GTK_WIDGET(self));
+        return;
     }
-    else
+
+    /* fixed items are obstacles for others so place them first */
+    for(l = self->fixed_items; l; l = l->next)
     {
-        x1 = x;
-        x2 = self->drag_start_x;
+        item = (FmDesktopItem*)l->data;
+        icon = NULL;
+        gtk_tree_model_get(model, &item->it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
+        calc_item_size(self, item, icon);
+        if(icon)
+            g_object_unref(icon);
+        desktop_grid_update(self, item);
     }
+    occupancy_init(self, &occ, rtl);
 
-    if(self->drag_start_y < y)
+    step = get_layout_step(self, rtl, &x);
+    do
     {
-        y1 = self->drag_start_y;
-        y2 = y;
+        item = fm_folder_model_get_item_userdata(self->model, &it);
+#ifdef G_ENABLE_DEBUG
+        n_items++;
+#endif
+        if(item->fixed_pos)
+            continue;
+        icon = NULL;
+        gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
+        /* item size doesn't depend on position so calculate it once */
+        calc_item_size(self, item, icon);
+        if(icon)
+            g_object_unref(icon);
+        place_item(self, &occ, item, &x, &y, step);
+        desktop_grid_update(self, item);
     }
-    else
+    while(gtk_tree_model_iter_next(model, &it));
+    occupancy_free(&occ);
+#ifdef G_ENABLE_DEBUG
+    g_debug("FmDesktop: layout of %u items (%u fixed) took %.3f ms", n_items,
+            g_list_length(self->fixed_items), g_timer_elapsed(timer, NULL) * 1000.0);
+    g_timer_destroy(timer);
+#endif
+    gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+/* lays out items starting from model row from, keeping positions of items
+   before it; stops as soon as an item after row to ends up in the same
+   slot as before since the rest will not change then */
+static void relayout_items(FmDesktop *self, guint from, guint to)
+{
+    FmDesktopItem *item, *prev = NULL;
+    GtkTreeModel *model;
+    GtkTreePath *tp;
+    GdkPixbuf *icon;
+    GtkTreeIter it;
+    FmDesktopOccupancy occ;
+    int x, y, step;
+    guint i;
+    gboolean rtl = (gtk_widget_get_direction(GTK_WIDGET(self)) == GTK_TEXT_DIR_RTL);
+#ifdef G_ENABLE_DEBUG
+    GTimer *timer = g_timer_new();
+    guint n_moved = 0;
+#endif
+
+    if (self->model == NULL)
+        return;
+    model = GTK_TREE_MODEL(self->model);
+    /* continue after the last auto placed item before the change */
+    for (i = from; i > 0 && prev == NULL; )
     {
-        y1 = y;
-        y2 = self->drag_start_y;
+        tp = gtk_tree_path_new_from_indices(--i, -1);
+        if (gtk_tree_model_get_iter(model, &it, tp))
+        {
+            item = fm_folder_model_get_item_userdata(self->model, &it);
+            if (!item->fixed_pos)
+                prev = item;
+        }
+        gtk_tree_path_free(tp);
+    }
+    step = get_layout_step(self, rtl, &x);
+    y = self->ymargin;
+    if (prev)
+    {
+        x = prev->area.x - self->working_area.x;
+        y = prev->area.y - self->working_area.y;
+        while (self->working_area.y + y < prev->area.y + prev->area.height)
+            y += self->cell_h;
     }
 
-    rect->x = x1;
-    rect->y = y1;
-    rect->width = x2 - x1;
-    rect->height = y2 - y1;
+    tp = gtk_tree_path_new_from_indices(from, -1);
+    if (!gtk_tree_model_get_iter(model, &it, tp))
+    {
+        /* the last item was removed, nothing to move */
+        gtk_tree_path_free(tp);
+#ifdef G_ENABLE_DEBUG
+        g_timer_destroy(timer);
+#endif
+        return;
+    }
+    gtk_tree_path_free(tp);
+    occupancy_init(self, &occ, rtl);
+    i = from;
+    do
+    {
+        item = fm_folder_model_get_item_userdata(self->model, &it);
+        if (item->fixed_pos)
+            continue;
+        if (item->is_placed)
+        {
+            if (i > to && item->layout_x == x && item->layout_y == y)
+                break;
+            redraw_item(self, item);
+        }
+        else
+        {
+            icon = NULL;
+            gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
+            calc_item_size(self, item, icon);
+            if (icon)
+                g_object_unref(icon);
+        }
+        place_item(self, &occ, item, &x, &y, step);
+        desktop_grid_update(self, item);
+        redraw_item(self, item);
+#ifdef G_ENABLE_DEBUG
+        n_moved++;
+#endif
+    }
+    while (++i, gtk_tree_model_iter_next(model, &it));
+    occupancy_free(&occ);
+#ifdef G_ENABLE_DEBUG
+    g_debug("FmDesktop: relayout from row %u moved %u items in %.3f ms", from,
+            n_moved, g_timer_elapsed(timer, NULL) * 1000.0);
+    g_timer_destroy(timer);
+#endif
 }
 
-static void update_rubberbanding(FmDesktop* self, int newx, int newy)
+static gboolean on_idle_layout(FmDesktop* desktop)
 {
-    GtkTreeModel* model = self->model ? GTK_TREE_MODEL(self->model) : NULL;
-    GtkTreeIter it;
-    GdkRectangle old_rect, new_rect;
-    //GdkRegion *region;
-    GdkWindow *window;
+    desktop->idle_layout = 0;
+    desktop->layout_pending = FALSE;
+    if (desktop->layout_partial)
+    {
+        desktop->layout_partial = FALSE;
+        relayout_items(desktop, desktop->relayout_from, desktop->relayout_to);
+    }
+    else
+        layout_items(desktop);
+    return FALSE;
+}
 
-    window = gtk_widget_get_window(GTK_WIDGET(self));
+static void queue_layout_items(FmDesktop* desktop)
+{
+    /* don't try to layout items until config is loaded,
+       this may be cause of the bug #927 on SF.net */
+    desktop->layout_partial = FALSE;
+    if (!gtk_widget_get_realized(GTK_WIDGET(desktop)))
+        desktop->layout_pending = TRUE;
+    else if (0 == desktop->idle_layout)
+        desktop->idle_layout = gdk_threads_add_idle((GSourceFunc)on_idle_layout, desktop);
+}
 
-    calc_rubber_banding_rect(self, self->rubber_bending_x, self->rubber_bending_y, &old_rect);
-    calc_rubber_banding_rect(self, newx, newy, &new_rect);
+/* queues layout after a row was inserted at index (inserted is TRUE) or
+   deleted from it; only items from that row on are laid out again unless
+   the full layout is queued already */
+static void queue_layout_items_from(FmDesktop* desktop, guint index, gboolean inserted)
+{
+    if (!desktop->layout_done || !gtk_widget_get_realized(GTK_WIDGET(desktop)))
+        queue_layout_items(desktop);
+    else if (0 == desktop->idle_layout)
+    {
+        desktop->layout_partial = TRUE;
+        desktop->relayout_from = desktop->relayout_to = index;
+        desktop->idle_layout = gdk_threads_add_idle((GSourceFunc)on_idle_layout, desktop);
+    }
+    else if (desktop->layout_partial)
+    {
+        /* rows after the change are shifted */
+        if (inserted && index <= desktop->relayout_to)
+            desktop->relayout_to++;
+        else if (!inserted && index < desktop->relayout_to)
+            desktop->relayout_to--;
+        desktop->relayout_from = MIN(desktop->relayout_from, index);
+        desktop->relayout_to = MAX(desktop->relayout_to, index);
+    }
+}
 
-    gdk_window_invalidate_rect(window, &old_rect, FALSE);
-    gdk_window_invalidate_rect(window, &new_rect, FALSE);
-//    gdk_window_clear_area(((GtkWidget*)self)->window, new_rect.x, new_rect.y, new_rect.width, new_rect.height);
-/*
-    region = gdk_region_rectangle(&old_rect);
-    gdk_region_union_with_rect(region, &new_rect);
+static inline guint32 _pack_color(const GdkColor* color)
+{
+    return 0xff000000 | ((guint32)(color->red >> 8) << 16)
+                      | ((guint32)(color->green >> 8) << 8) | (color->blue >> 8);
+}
 
-//    gdk_window_invalidate_region(((GtkWidget*)self)->window, &region, TRUE);
+#if GTK_CHECK_VERSION(3, 0, 0)
+static inline guint32 _pack_rgba(const GdkRGBA* rgba)
+{
+    return ((guint32)(rgba->alpha * 255.0 + 0.5) << 24)
+           | ((guint32)(rgba->red * 255.0 + 0.5) << 16)
+           | ((guint32)(rgba->green * 255.0 + 0.5) << 8)
+           | (guint32)(rgba->blue * 255.0 + 0.5);
+}
+#endif
 
-    gdk_region_destroy(region);
-*/
-    self->rubber_bending_x = newx;
-    self->rubber_bending_y = newy;
+static inline void _set_source_packed(cairo_t* cr, guint32 color)
+{
+    cairo_set_source_rgba(cr, ((color >> 16) & 0xff) / 255.0,
+                          ((color >> 8) & 0xff) / 255.0, (color & 0xff) / 255.0,
+                          (color >> 24) / 255.0);
+}
 
-    /* update selection */
-    if(model && gtk_tree_model_get_iter_first(model, &it)) do
-    {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(self->model, &it);
-        gboolean selected;
-        if(gdk_rectangle_intersect(&new_rect, &item->icon_rect, NULL) ||
-            gdk_rectangle_intersect(&new_rect, &item->text_rect, NULL))
-            selected = TRUE;
-        else
-            selected = FALSE;
+/* draws label of item: text over the selection background if the item is
+   selected or text with the shadow otherwise */
+static void draw_item_label(FmDesktop* self, FmDesktopItem* item, cairo_t* cr,
+                            gboolean selected, guint32 fg, guint32 bg)
+{
+    PangoLayout* pl = get_item_layout(self, item);
+    int text_x, text_y;
 
-        /* we cannot compare booleans, TRUE may be 1 or -1 */
-        if ((item->is_rubber_banded && !selected) ||
-            (!item->is_rubber_banded && selected))
-        {
-            item->is_selected = selected;
-            redraw_item(self, item);
-            fm_desktop_item_selected_changed(self, item);
-        }
-        item->is_rubber_banded = self->rubber_bending && selected;
+    text_x = item->area.x + (self->cell_w - self->text_w)/2 + 2;
+    text_y = item->text_rect.y + 2;
+    if(selected) /* draw background for text label */
+    {
+        _set_source_packed(cr, bg);
+        gdk_cairo_rectangle(cr, &item->text_rect);
+        cairo_fill(cr);
     }
-    while(gtk_tree_model_iter_next(model, &it));
+    else
+    {
+        /* the shadow */
+        _set_source_packed(cr, bg);
+        cairo_move_to(cr, text_x + 1, text_y + 1);
+        pango_cairo_show_layout(cr, pl);
+    }
+    /* real text */
+    _set_source_packed(cr, fg);
+    cairo_move_to(cr, text_x, text_y);
+    pango_cairo_show_layout(cr, pl);
 }
 
+static int get_label_scale(FmDesktop* self)
+{
+#if GTK_CHECK_VERSION(3, 10, 0)
+    return gdk_window_get_scale_factor(gtk_widget_get_window(GTK_WIDGET(self)));
+#else
+    return 1;
+#endif
+}
 
-static void paint_rubber_banding_rect(FmDesktop* self, cairo_t* cr, GdkRectangle* expose_area)
+/* tests if labels of n_items painted at once can be taken from the cache:
+   if they don't fit into it then every one would be rendered and evicted
+   again on each expose, that is slower than drawing the text directly */
+static gboolean use_label_cache(FmDesktop* self, guint n_items)
 {
-    GtkWidget* widget = (GtkWidget*)self;
-    GdkRectangle rect;
-    GdkColor clr;
-    guchar alpha;
+    gsize limit = (gsize)MAX(app_config->desktop_label_cache, 0) * 1024;
+    const cairo_font_options_t* opts;
+    int scale = get_label_scale(self);
+    gsize size;
 
-    calc_rubber_banding_rect(self, self->rubber_bending_x, self->rubber_bending_y, &rect);
+    /* text on transparent surface cannot have subpixel antialiasing */
+    opts = pango_cairo_context_get_font_options(gtk_widget_get_pango_context(GTK_WIDGET(self)));
+    if(opts && cairo_font_options_get_antialias(opts) == CAIRO_ANTIALIAS_SUBPIXEL)
+        return FALSE;
+    size = (gsize)(self->text_w + 2) * (self->text_h + 2) * 4 * scale * scale;
+    return size * n_items <= limit;
+}
 
-    if(rect.width <= 0 || rect.height <= 0)
-        return;
+/* returns image of item label drawn by draw_item_label(); images are kept
+   for recently painted items up to the app_config->desktop_label_cache KiB */
+static cairo_surface_t* get_item_label(FmDesktop* self, FmDesktopItem* item,
+                                       gboolean selected, guint32 fg, guint32 bg)
+{
+    gsize limit = (gsize)MAX(app_config->desktop_label_cache, 0) * 1024;
+    int scale = get_label_scale(self);
+    cairo_t* cr;
 
-    if(!gdk_rectangle_intersect(expose_area, &rect, &rect))
-        return;
-/*
-    gtk_widget_style_get(icon_view,
-                        "selection-box-color", &clr,
-                        "selection-box-alpha", &alpha,
-                        NULL);
-*/
-    clr = gtk_widget_get_style (widget)->base[GTK_STATE_SELECTED];
-    alpha = 64;  /* FIXME: should be themable in the future */
+    /* images are made for the window scale, redo them if it's changed */
+    if(scale != self->label_scale)
+    {
+        clear_label_cache(self);
+        self->label_scale = scale;
+    }
+    /* it also drops the image if text was changed */
+    get_item_layout(self, item);
+    /* we cannot compare booleans, TRUE may be 1 or -1 */
+    if(item->label && (!item->label_selected == !selected)
+       && item->label_fg == fg && item->label_bg == bg)
+    {
+        /* move it to the head of LRU list */
+        g_queue_unlink(&self->label_cache, item->label_link);
+        g_queue_push_head_link(&self->label_cache, item->label_link);
+        return item->label;
+    }
+    drop_item_label(self, item);
 
-    cairo_save(cr);
-    cairo_set_source_rgba(cr, (gdouble)clr.red/65535, (gdouble)clr.green/65536, (gdouble)clr.blue/65535, (gdouble)alpha/100);
-    gdk_cairo_rectangle(cr, &rect);
-    cairo_clip (cr);
-    cairo_paint (cr);
-    gdk_cairo_set_source_color(cr, &clr);
-    cairo_rectangle (cr, rect.x + 0.5, rect.y + 0.5, rect.width - 1, rect.height - 1);
-    cairo_stroke(cr);
-    cairo_restore(cr);
+    /* leave 1 pixel around the text rect as redraw_item() does */
+#if GTK_CHECK_VERSION(3, 10, 0)
+    item->label = gdk_window_create_similar_image_surface(gtk_widget_get_window(GTK_WIDGET(self)),
+                                                          CAIRO_FORMAT_ARGB32,
+                                                          item->text_rect.width + 2,
+                                                          item->text_rect.height + 2,
+                                                          scale);
+#else
+    item->label = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                             item->text_rect.width + 2,
+                                             item->text_rect.height + 2);
+#endif
+    item->label_selected = selected;
+    item->label_fg = fg;
+    item->label_bg = bg;
+    cr = cairo_create(item->label);
+    cairo_translate(cr, 1 - item->text_rect.x, 1 - item->text_rect.y);
+    draw_item_label(self, item, cr, selected, fg, bg);
+    cairo_destroy(cr);
+
+    item->label_link = g_list_alloc();
+    item->label_link->data = item;
+    g_queue_push_head_link(&self->label_cache, item->label_link);
+    self->label_cache_size += cairo_image_surface_get_stride(item->label)
+                              * cairo_image_surface_get_height(item->label);
+    /* evict least recently painted labels but never the one just created */
+    while(self->label_cache_size > limit && self->label_cache.length > 1)
+        drop_item_label(self, g_queue_peek_tail(&self->label_cache));
+    return item->label;
 }
 
-static void _free_cache_image(FmBackgroundCache *cache)
+static void paint_item(FmDesktop* self, FmDesktopItem* item, cairo_t* cr, GdkRectangle* expose_area,
+                       GdkPixbuf* icon, gboolean cache_label)
 {
 #if GTK_CHECK_VERSION(3, 0, 0)
-    XFreePixmap(cairo_xlib_surface_get_display(cache->bg),
-                cairo_xlib_surface_get_drawable(cache->bg));
-    cairo_surface_destroy(cache->bg);
+    GtkStyleContext* style;
 #else
-    g_object_unref(cache->bg);
+    GtkStyle* style;
 #endif
-    cache->bg = NULL;
-    cache->wallpaper_mode = FM_WP_COLOR; /* for cache check */
+    GtkWidget* widget = (GtkWidget*)self;
+    GtkCellRendererState state = 0;
+#if GTK_CHECK_VERSION(3, 0, 0)
+    GdkRGBA rgba;
+#else
+    GdkWindow* window;
+#endif
+    cairo_surface_t* label;
+    guint32 fg, bg;
+
+    /* don't draw dragged items on desktop, they are moved with mouse */
+    if (item->is_selected && self->dragging)
+        return;
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+    style = gtk_widget_get_style_context(widget);
+#else
+    style = gtk_widget_get_style(widget);
+    window = gtk_widget_get_window(widget);
+#endif
+
+    if(item->is_selected || item == self->drop_hilight)
+    {
+        state = GTK_CELL_RENDERER_SELECTED;
+#if GTK_CHECK_VERSION(3, 0, 0)
+        gtk_style_context_get_background_color(style, GTK_STATE_FLAG_SELECTED, &rgba);
+        bg = _pack_rgba(&rgba);
+        gtk_style_context_get_color(style, GTK_STATE_FLAG_SELECTED, &rgba);
+        fg = _pack_rgba(&rgba);
+#else
+        bg = _pack_color(&style->bg[GTK_STATE_SELECTED]);
+        fg = _pack_color(&style->fg[GTK_STATE_SELECTED]);
+#endif
+    }
+    else
+    {
+        bg = _pack_color(&self->conf.desktop_shadow);
+        fg = _pack_color(&self->conf.desktop_fg);
+    }
+    if(cache_label)
+    {
+        label = get_item_label(self, item, state == GTK_CELL_RENDERER_SELECTED, fg, bg);
+        cairo_set_source_surface(cr, label, item->text_rect.x - 1, item->text_rect.y - 1);
+        cairo_paint(cr);
+    }
+    else
+        draw_item_label(self, item, cr, state == GTK_CELL_RENDERER_SELECTED, fg, bg);
+
+    if(item == self->focus && gtk_widget_has_focus(widget))
+#if GTK_CHECK_VERSION(3, 0, 0)
+        gtk_render_focus(style, cr,
+#else
+        gtk_paint_focus(style, window, gtk_widget_get_state(widget),
+                        expose_area, widget, "icon_view",
+#endif
+                        item->text_rect.x, item->text_rect.y, item->text_rect.width, item->text_rect.height);
+
+    /* draw the icon */
+    g_object_set(self->icon_render, "pixbuf", icon, "info", item->fi, NULL);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), cr, widget, &item->icon_rect, &item->icon_rect, state);
+#else
+    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), window, widget, &item->icon_rect, &item->icon_rect, expose_area, state);
+#endif
+}
+
+static void redraw_item(FmDesktop* desktop, FmDesktopItem* item)
+{
+    GdkRectangle rect;
+    get_item_rect(item, &rect);
+    --rect.x;
+    --rect.y;
+    rect.width += 2;
+    rect.height += 2;
+    gdk_window_invalidate_rect(gtk_widget_get_window(GTK_WIDGET(desktop)), &rect, FALSE);
+}
+
+static void move_item(FmDesktop* desktop, FmDesktopItem* item, int x, int y, gboolean redraw)
+{
+    /* this call invalid the area occupied by the item and a redraw
+     * is queued. */
+    if(redraw)
+        redraw_item(desktop, item);
+
+    /* correct coords to put item within working area still */
+    if (x > desktop->working_area.x + desktop->working_area.width - desktop->xmargin - item->area.width)
+        x = desktop->working_area.x + desktop->working_area.width - desktop->xmargin - item->area.width;
+    if (x < desktop->working_area.x + desktop->xmargin)
+        x = desktop->working_area.x + desktop->xmargin;
+    if (y > desktop->working_area.y + desktop->working_area.height - desktop->ymargin - item->area.height)
+        y = desktop->working_area.y + desktop->working_area.height - desktop->ymargin - item->area.height;
+    if (y < desktop->working_area.y + desktop->ymargin)
+        y = desktop->working_area.y + desktop->ymargin;
+
+    /* calc_item_size(desktop, item); */
+    shift_item(desktop, item, x, y);
+
+    desktop_grid_update(desktop, item);
+
+    /* make the item use customized fixed position. */
+    if(!item->fixed_pos)
+    {
+        item->fixed_pos = TRUE;
+        desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
+    }
+
+    /* move the item to a new place, and queue a redraw for the new rect. */
+    if(redraw)
+        redraw_item(desktop, item);
+}
+
+static void calc_rubber_banding_rect(FmDesktop* self, int x, int y, GdkRectangle* rect)
+{
+    int x1, x2, y1, y2;
+    if(self->drag_start_x < x)
+    {
+        x1 = self->drag_start_x;
+        x2 = x;
+    }
+    else
+    {
+        x1 = x;
+        x2 = self->drag_start_x;
+    }
+
+    if(self->drag_start_y < y)
+    {
+        y1 = self->drag_start_y;
+        y2 = y;
+    }
+    else
+    {
+        y1 = y;
+        y2 = self->drag_start_y;
+    }
+
+    rect->x = x1;
+    rect->y = y1;
+    rect->width = x2 - x1;
+    rect->height = y2 - y1;
+}
+
+static void _update_rubberbanded_item(FmDesktop *self, FmDesktopItem *item,
+                                      gpointer user_data)
+{
+    GdkRectangle *new_rect = user_data;
+    gboolean selected;
+
+    if(gdk_rectangle_intersect(new_rect, &item->icon_rect, NULL) ||
+        gdk_rectangle_intersect(new_rect, &item->text_rect, NULL))
+        selected = TRUE;
+    else
+        selected = FALSE;
+
+    /* we cannot compare booleans, TRUE may be 1 or -1 */
+    if ((item->is_rubber_banded && !selected) ||
+        (!item->is_rubber_banded && selected))
+    {
+        set_item_selected(self, item, selected);
+        redraw_item(self, item);
+        fm_desktop_item_selected_changed(self, item);
+    }
+    item->is_rubber_banded = self->rubber_bending && selected;
+}
+
+/* puts parts of rectangle a which are outside of b into out, returns count */
+static int _subtract_rect(const GdkRectangle *a, const GdkRectangle *b,
+                          GdkRectangle *out)
+{
+    GdkRectangle isect;
+    int n = 0;
+
+    if (a->width <= 0 || a->height <= 0)
+        return 0;
+    if (!gdk_rectangle_intersect(a, b, &isect))
+    {
+        out[0] = *a;
+        return 1;
+    }
+    if (isect.y > a->y) /* top strip */
+    {
+        out[n].x = a->x;
+        out[n].y = a->y;
+        out[n].width = a->width;
+        out[n++].height = isect.y - a->y;
+    }
+    if (isect.y + isect.height < a->y + a->height) /* bottom strip */
+    {
+        out[n].x = a->x;
+        out[n].y = isect.y + isect.height;
+        out[n].width = a->width;
+        out[n].height = a->y + a->height - out[n].y;
+        n++;
+    }
+    if (isect.x > a->x) /* left part of middle band */
+    {
+        out[n].x = a->x;
+        out[n].y = isect.y;
+        out[n].width = isect.x - a->x;
+        out[n++].height = isect.height;
+    }
+    if (isect.x + isect.width < a->x + a->width) /* right part of middle band */
+    {
+        out[n].x = isect.x + isect.width;
+        out[n].y = isect.y;
+        out[n].width = a->x + a->width - out[n].x;
+        out[n].height = isect.height;
+        n++;
+    }
+    return n;
+}
+
+/* invalidates the border of rubber banding rectangle */
+static void _invalidate_rect_frame(GdkWindow *window, const GdkRectangle *rect)
+{
+    GdkRectangle edge;
+
+    edge = *rect;
+    edge.height = 1;
+    gdk_window_invalidate_rect(window, &edge, FALSE);
+    edge.y = rect->y + rect->height - 1;
+    gdk_window_invalidate_rect(window, &edge, FALSE);
+    edge = *rect;
+    edge.width = 1;
+    gdk_window_invalidate_rect(window, &edge, FALSE);
+    edge.x = rect->x + rect->width - 1;
+    gdk_window_invalidate_rect(window, &edge, FALSE);
+}
+
+static void update_rubberbanding(FmDesktop* self, int newx, int newy)
+{
+    GdkRectangle old_rect, new_rect, rects[8];
+    GdkWindow *window;
+    int i, n;
+
+    window = gtk_widget_get_window(GTK_WIDGET(self));
+
+    calc_rubber_banding_rect(self, self->rubber_bending_x, self->rubber_bending_y, &old_rect);
+    calc_rubber_banding_rect(self, newx, newy, &new_rect);
+
+    self->rubber_bending_x = newx;
+    self->rubber_bending_y = newy;
+
+    if (self->rubber_bending)
+    {
+        /* only items within the area which was entered or left may change,
+           and only that area and borders of the rectangle need repaint */
+        n = _subtract_rect(&old_rect, &new_rect, rects);
+        n += _subtract_rect(&new_rect, &old_rect, &rects[n]);
+        for (i = 0; i < n; i++)
+            gdk_window_invalidate_rect(window, &rects[i], FALSE);
+        _invalidate_rect_frame(window, &old_rect);
+        _invalidate_rect_frame(window, &new_rect);
+    }
+    else
+    {
+        /* finishing: reset is_rubber_banded on every item within rectangle */
+        gdk_window_invalidate_rect(window, &old_rect, FALSE);
+        gdk_window_invalidate_rect(window, &new_rect, FALSE);
+        rects[0] = old_rect;
+        rects[1] = new_rect;
+        n = 2;
+    }
+    if (n > 0)
+        desktop_grid_foreach(self, rects, n, _update_rubberbanded_item, &new_rect);
+}
+
+/* pointer motion is applied once per frame and only for the last pointer
+   position: with GTK+ 3.8+ it is done by the frame clock right before the
+   frame is painted, with older ones once per main loop iteration, after
+   all pending motion events are handled but before the window is redrawn */
+static void apply_motion(FmDesktop* self)
+{
+    self->motion_processed++;
+    if (self->rubber_bending)
+        update_rubberbanding(self, self->motion_pending_x, self->motion_pending_y);
+    else if (!self->button_pressed)
+        update_hover(self, self->motion_pending_x, self->motion_pending_y);
+}
+
+#if GTK_CHECK_VERSION(3, 8, 0)
+static gboolean on_motion_tick(GtkWidget* w, GdkFrameClock* clock, gpointer unused)
+{
+    FmDesktop *self = FM_DESKTOP(w);
+
+    self->idle_motion = 0;
+    apply_motion(self);
+    return FALSE;
+}
+#else
+static gboolean on_idle_motion(gpointer user_data)
+{
+    FmDesktop *self = user_data;
+
+    if (g_source_is_destroyed(g_main_current_source()))
+        return FALSE;
+    self->idle_motion = 0;
+    apply_motion(self);
+    return FALSE;
+}
+#endif
+
+static void queue_motion(FmDesktop* self, int newx, int newy)
+{
+    self->motion_pending_x = newx;
+    self->motion_pending_y = newy;
+    self->motion_received++;
+    if (self->idle_motion != 0)
+        return;
+#if GTK_CHECK_VERSION(3, 8, 0)
+    self->idle_motion = gtk_widget_add_tick_callback(GTK_WIDGET(self),
+                                                     on_motion_tick, NULL, NULL);
+#else
+    self->idle_motion = gdk_threads_add_idle_full(G_PRIORITY_HIGH_IDLE + 10,
+                                                  on_idle_motion, self, NULL);
+#endif
+}
+
+static void cancel_motion(FmDesktop* self)
+{
+    if (self->idle_motion == 0)
+        return;
+#if GTK_CHECK_VERSION(3, 8, 0)
+    gtk_widget_remove_tick_callback(GTK_WIDGET(self), self->idle_motion);
+#else
+    g_source_remove(self->idle_motion);
+#endif
+    self->idle_motion = 0;
+}
+
+
+static void paint_rubber_banding_rect(FmDesktop* self, cairo_t* cr, GdkRectangle* expose_area)
+{
+    GtkWidget* widget = (GtkWidget*)self;
+    GdkRectangle rect;
+    GdkColor clr;
+    guchar alpha;
+
+    calc_rubber_banding_rect(self, self->rubber_bending_x, self->rubber_bending_y, &rect);
+
+    if(rect.width <= 0 || rect.height <= 0)
+        return;
+
+    if(!gdk_rectangle_intersect(expose_area, &rect, &rect))
+        return;
+/*
+    gtk_widget_style_get(icon_view,
+                        "selection-box-color", &clr,
+                        "selection-box-alpha", &alpha,
+                        NULL);
+*/
+    clr = gtk_widget_get_style (widget)->base[GTK_STATE_SELECTED];
+    alpha = 64;  /* FIXME: should be themable in the future */
+
+    cairo_save(cr);
+    cairo_set_source_rgba(cr, (gdouble)clr.red/65535, (gdouble)clr.green/65536, (gdouble)clr.blue/65535, (gdouble)alpha/100);
+    gdk_cairo_rectangle(cr, &rect);
+    cairo_clip (cr);
+    cairo_paint (cr);
+    gdk_cairo_set_source_color(cr, &clr);
+    cairo_rectangle (cr, rect.x + 0.5, rect.y + 0.5, rect.width - 1, rect.height - 1);
+    cairo_stroke(cr);
+    cairo_restore(cr);
+}
+
+/* wallpaper images are shared by all desktops, see _bg_cache_key() */
+static GHashTable *bg_cache_store = NULL;
+
+static void _free_cache_image(FmBackgroundCache *cache)
+{
+    if(cache->bg == NULL)
+        return;
+#if GTK_CHECK_VERSION(3, 0, 0)
+    XFreePixmap(cairo_xlib_surface_get_display(cache->bg),
+                cairo_xlib_surface_get_drawable(cache->bg));
+    cairo_surface_destroy(cache->bg);
+#else
+    g_object_unref(cache->bg);
+#endif
+    cache->bg = NULL;
+}
+
+/* the key contains everything the rendered pixmap depends on, therefore
+   monitors of the same size showing the same image share one pixmap */
+static char *_bg_cache_key(GdkScreen *screen, const char *filename,
+                           time_t mtime, FmWallpaperMode mode,
+                           ImageOpsScaleMode scale, int dest_w, int dest_h,
+                           int ox, int oy, const GdkColor *color)
+{
+    return g_strdup_printf("%d:%ld:%d:%d:%dx%d%+d%+d:%04x%04x%04x:%s",
+                           gdk_screen_get_number(screen), (long)mtime,
+                           (int)mode, (int)scale, dest_w, dest_h, ox, oy, color->red,
+                           color->green, color->blue, filename);
+}
+
+static inline FmBackgroundCache *_bg_cache_lookup(const char *key)
+{
+    if(bg_cache_store == NULL)
+        return NULL;
+    return g_hash_table_lookup(bg_cache_store, key);
+}
+
+/* creates new empty entry in the store, the caller should render it and
+   then call _bg_cache_hold() */
+static FmBackgroundCache *_bg_cache_new(const char *key, const char *filename)
+{
+    FmBackgroundCache *cache = g_slice_new0(FmBackgroundCache);
+
+    if(G_UNLIKELY(bg_cache_store == NULL))
+        bg_cache_store = g_hash_table_new(g_str_hash, g_str_equal);
+    cache->key = g_strdup(key);
+    cache->filename = g_strdup(filename);
+    g_hash_table_insert(bg_cache_store, cache->key, cache);
+    g_debug("adding new FmBackgroundCache for %s", filename);
+    return cache;
+}
+
+/* adds a reference from the desktop unless it already has one */
+static void _bg_cache_hold(FmDesktop *self, FmBackgroundCache *cache)
+{
+    if(g_slist_find(self->cache, cache))
+        return;
+    cache->ref++;
+    self->cache = g_slist_prepend(self->cache, cache);
+}
+
+static void _bg_cache_unref(FmBackgroundCache *cache)
+{
+    if(--cache->ref > 0)
+        return;
+    g_hash_table_remove(bg_cache_store, cache->key);
+    _free_cache_image(cache);
+    g_free(cache->key);
+    g_free(cache->filename);
+    g_slice_free(FmBackgroundCache, cache);
+}
+
+static void _clear_bg_cache(FmDesktop *self)
+{
+    g_slist_foreach(self->cache, (GFunc)_bg_cache_unref, NULL);
+    g_slist_free(self->cache);
+    self->cache = NULL;
+}
+
+/* releases cached images which aren't needed by the desktop anymore; it is
+   done only after another background is set since X may still use them */
+static void _prune_bg_cache(FmDesktop *self, FmBackgroundCache *keep)
+{
+    GSList **prev = &self->cache, *l;
+    FmBackgroundCache *cache;
+    int i;
+
+    while((l = *prev) != NULL)
+    {
+        cache = l->data;
+        if(cache != keep && !self->conf.wallpaper_common &&
+           /* the same file but mode, size or mtime was changed */
+           (keep == NULL || strcmp(keep->filename, cache->filename) != 0))
+        {
+            for(i = 0; i < self->conf.wallpapers_configured; i++)
+                if(g_strcmp0(self->conf.wallpapers[i], cache->filename) == 0)
+                    break;
+            if(i < self->conf.wallpapers_configured) /* still in use */
+                cache = keep;
+        }
+        if(cache == keep)
+        {
+            prev = &l->next;
+            continue;
+        }
+        *prev = l->next;
+        g_slist_free_1(l);
+        _bg_cache_unref(cache);
+    }
+}
+
+/* wallpaper image which is being prepared in the worker thread */
+struct _FmBackgroundJob
+{
+    FmDesktop *desktop; /* reference */
+    GCancellable *cancellable;
+    char *filename;
+    time_t mtime;
+    FmWallpaperMode wallpaper_mode;
+    GdkColor bg_color;
+    int dest_w, dest_h; /* size of the desktop image, not used for tile mode */
+    ImageOpsScaleMode scale_mode;
+    int x, y; /* position of pix within the desktop image */
+    int ox, oy; /* offset of the monitor within the image in screen mode */
+    gboolean fill_bg; /* fill with background color before drawing pix */
+    GdkPixbuf *pix; /* the result, NULL if failed or cancelled */
+    char *cache_file; /* file in the on-disk cache, NULL to not use it */
+    char *key; /* key for bg_cache_store */
+};
+
+static GThreadPool *wallpaper_pool = NULL;
+
+static void _bg_job_free(FmBackgroundJob *job)
+{
+    g_object_unref(job->desktop);
+    g_object_unref(job->cancellable);
+    g_free(job->filename);
+    g_free(job->cache_file);
+    g_free(job->key);
+    if(job->pix)
+        g_object_unref(job->pix);
+    g_slice_free(FmBackgroundJob, job);
+}
+
+static void _bg_job_cancel(FmDesktop *desktop)
+{
+    if(desktop->bg_job == NULL)
+        return;
+    g_cancellable_cancel(desktop->bg_job->cancellable);
+    /* it will be freed by _bg_job_finished() */
+    desktop->bg_job = NULL;
+}
+
+/* draws the image into new pixmap of the cache */
+static void _bg_cache_render(FmDesktop *desktop, FmBackgroundCache *cache,
+                             FmBackgroundJob *job)
+{
+    GdkScreen *screen = gtk_widget_get_screen(GTK_WIDGET(desktop));
+    int dest_w = job->dest_w, dest_h = job->dest_h;
+    cairo_t *cr;
+#if GTK_CHECK_VERSION(3, 0, 0)
+    GdkWindow *root = gdk_screen_get_root_window(screen);
+    int screen_num = gdk_screen_get_number(screen);
+    Display *xdisplay;
+    Pixmap xpixmap;
+#endif
+
+    if(job->wallpaper_mode == FM_WP_TILE)
+    {
+        dest_w = gdk_pixbuf_get_width(job->pix);
+        dest_h = gdk_pixbuf_get_height(job->pix);
+    }
+#if GTK_CHECK_VERSION(3, 0, 0)
+    xdisplay = GDK_WINDOW_XDISPLAY(root);
+    /* this code is taken from libgnome-desktop */
+    xpixmap = XCreatePixmap(xdisplay, RootWindow(xdisplay, screen_num),
+                            dest_w, dest_h, DefaultDepth(xdisplay, screen_num));
+    cache->bg = cairo_xlib_surface_create(xdisplay, xpixmap,
+                                          GDK_VISUAL_XVISUAL(gdk_screen_get_system_visual(screen)),
+                                          dest_w, dest_h);
+    cr = cairo_create(cache->bg);
+#else
+    cache->bg = gdk_pixmap_new(gtk_widget_get_window(GTK_WIDGET(desktop)),
+                               dest_w, dest_h, -1);
+    cr = gdk_cairo_create(cache->bg);
+#endif
+    if(job->fill_bg)
+    {
+        gdk_cairo_set_source_color(cr, &job->bg_color);
+        cairo_rectangle(cr, 0, 0, dest_w, dest_h);
+        cairo_fill(cr);
+    }
+    gdk_cairo_set_source_pixbuf(cr, job->pix, job->x, job->y);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+}
+
+/* sets the cached image as background of the desktop and root window */
+static void _bg_cache_apply(FmDesktop *desktop, FmBackgroundCache *cache)
+{
+    GtkWidget* widget = (GtkWidget*)desktop;
+    GdkScreen *screen = gtk_widget_get_screen(widget);
+    GdkWindow* root = gdk_screen_get_root_window(screen);
+    GdkWindow *window = gtk_widget_get_window(widget);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    cairo_pattern_t *pattern;
+#endif
+    Display* xdisplay;
+    Pixmap xpixmap;
+    Window xroot;
+    int screen_num = gdk_screen_get_number(screen);
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+    pattern = cairo_pattern_create_for_surface(cache->bg);
+    gdk_window_set_background_pattern(window, pattern);
+    cairo_pattern_destroy(pattern);
+#else
+    gdk_window_set_back_pixmap(window, cache->bg, FALSE);
+#endif
+
+    /* set root map here */
+    xdisplay = GDK_WINDOW_XDISPLAY(root);
+    xroot = RootWindow(xdisplay, screen_num);
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+    xpixmap = cairo_xlib_surface_get_drawable(cache->bg);
+#else
+    xpixmap = GDK_WINDOW_XWINDOW(cache->bg);
+#endif
+
+    XChangeProperty(xdisplay, GDK_WINDOW_XID(root),
+                    XA_XROOTMAP_ID, XA_PIXMAP, 32, PropModeReplace, (guchar*)&xpixmap, 1);
+
+    XGrabServer (xdisplay);
+
+#if 0
+    result = XGetWindowProperty (display,
+                                 RootWindow (display, screen_num),
+                                 gdk_x11_get_xatom_by_name ("ESETROOT_PMAP_ID"),
+                                 0L, 1L, False, XA_PIXMAP,
+                                 &type, &format, &nitems,
+                                 &bytes_after,
+                                 &data_esetroot);
+
+    if (data_esetroot != NULL) {
+            if (result == Success && type == XA_PIXMAP &&
+                format == 32 &&
+                nitems == 1) {
+                    gdk_error_trap_push ();
+                    XKillClient (display, *(Pixmap *)data_esetroot);
+                    gdk_error_trap_pop_ignored ();
+            }
+            XFree (data_esetroot);
+    }
+
+    XChangeProperty (display, RootWindow (display, screen_num),
+                     gdk_x11_get_xatom_by_name ("ESETROOT_PMAP_ID"),
+                     XA_PIXMAP, 32, PropModeReplace,
+                     (guchar *) &xpixmap, 1);
+#endif
+
+    XChangeProperty(xdisplay, xroot, XA_XROOTPMAP_ID, XA_PIXMAP, 32,
+                    PropModeReplace, (guchar*)&xpixmap, 1);
+
+    XSetWindowBackgroundPixmap(xdisplay, xroot, xpixmap);
+    XClearWindow(xdisplay, xroot);
+
+    XFlush(xdisplay);
+    XUngrabServer(xdisplay);
+
+    gdk_window_invalidate_rect(window, NULL, TRUE);
+    _prune_bg_cache(desktop, cache);
+}
+
+/* sets solid color as background of the desktop */
+static void _bg_color_apply(FmDesktop *desktop)
+{
+    GdkWindow *window = gtk_widget_get_window(GTK_WIDGET(desktop));
+#if GTK_CHECK_VERSION(3, 0, 0)
+    cairo_pattern_t *pattern;
+
+    pattern = cairo_pattern_create_rgb(desktop->conf.desktop_bg.red / 65535.0,
+                                       desktop->conf.desktop_bg.green / 65535.0,
+                                       desktop->conf.desktop_bg.blue / 65535.0);
+    gdk_window_set_background_pattern(window, pattern);
+    cairo_pattern_destroy(pattern);
+#else
+    GdkColor bg = desktop->conf.desktop_bg;
+
+    gdk_colormap_alloc_color(gdk_drawable_get_colormap(window), &bg, FALSE, TRUE);
+    gdk_window_set_back_pixmap(window, NULL, FALSE);
+    gdk_window_set_background(window, &bg);
+#endif
+    gdk_window_invalidate_rect(window, NULL, TRUE);
+    _prune_bg_cache(desktop, NULL);
+}
+
+static gboolean _bg_job_finished(gpointer user_data)
+{
+    FmBackgroundJob *job = user_data;
+    FmDesktop *desktop = job->desktop;
+    FmBackgroundCache *cache;
+
+    /* ignore result if another background was requested meanwhile */
+    if(desktop->bg_job == job)
+    {
+        desktop->bg_job = NULL;
+        if(job->pix)
+        {
+            /* another desktop might render the same image meanwhile */
+            cache = _bg_cache_lookup(job->key);
+            if(cache == NULL)
+            {
+                cache = _bg_cache_new(job->key, job->filename);
+                _bg_cache_render(desktop, cache, job);
+            }
+            _bg_cache_hold(desktop, cache);
+            _bg_cache_apply(desktop, cache);
+        }
+        else /* cannot load the image, show solid color instead */
+            _bg_color_apply(desktop);
+    }
+    _bg_job_free(job);
+    return FALSE;
+}
+
+/* on-disk cache of scaled wallpapers: each file is a header followed by
+   raw rows of pixels, so it can be mapped and used without decoding */
+#define BG_DISK_CACHE_MAGIC "PCMFMWP\001"
+#define BG_DISK_CACHE_MAX 16 /* files kept in the cache directory */
+#define BG_DISK_CACHE_MAX_SIZE (128 << 20) /* bytes kept in the cache directory */
+
+typedef struct
+{
+    char magic[8];
+    guint32 width;
+    guint32 height;
+    guint32 rowstride;
+    guint32 n_channels;
+    guint32 has_alpha;
+    guint32 reserved;
+} FmBackgroundFileHeader;
+
+static char *_bg_disk_cache_dir(void)
+{
+    char *dir = pcmanfm_get_profile_dir(FALSE);
+    char *path = g_build_filename(dir, "wallpaper-cache", NULL);
+
+    g_free(dir);
+    return path;
+}
+
+/* returns the name of the file in cache for the job, NULL if not cacheable */
+static char *_bg_disk_cache_file(FmBackgroundJob *job)
+{
+    char *key, *sum, *dir, *name, *path;
+
+    if(job->mtime == 0) /* file isn't accessible */
+        return NULL;
+    /* tiled and centered images aren't scaled, there is nothing to save
+       but decoding and raw copy of big image would take too much space */
+    if(job->wallpaper_mode == FM_WP_TILE || job->wallpaper_mode == FM_WP_CENTER)
+        return NULL;
+    key = g_strdup_printf("%s\n%ld\n%d\n%d\n%d\n%d", job->filename, (long)job->mtime,
+                          (int)job->wallpaper_mode, job->dest_w, job->dest_h,
+                          (int)job->scale_mode);
+    sum = g_compute_checksum_for_string(G_CHECKSUM_MD5, key, -1);
+    dir = _bg_disk_cache_dir();
+    name = g_strconcat(sum, ".raw", NULL);
+    path = g_build_filename(dir, name, NULL);
+    g_free(name);
+    g_free(dir);
+    g_free(sum);
+    g_free(key);
+    return path;
+}
+
+static void _bg_mapped_file_free(guchar *pixels, gpointer mf)
+{
+#if GLIB_CHECK_VERSION(2, 22, 0)
+    g_mapped_file_unref(mf);
+#else
+    g_mapped_file_free(mf);
+#endif
+}
+
+/* maps the cached image, runs in the worker thread */
+static GdkPixbuf *_bg_disk_cache_load(FmBackgroundJob *job)
+{
+    GMappedFile *mf;
+    FmBackgroundFileHeader hdr;
+    GdkPixbuf *pix;
+    const char *data;
+    struct stat st;
+    int fd;
+    gboolean valid;
+
+    if(job->cache_file == NULL)
+        return NULL;
+    /* check the file before mapping it: access to mapped pages beyond end
+       of the file would crash with SIGBUS instead of returning an error */
+    fd = g_open(job->cache_file, O_RDONLY, 0);
+    if(fd < 0)
+        return NULL;
+    valid = (fstat(fd, &st) == 0 && read(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+             && memcmp(hdr.magic, BG_DISK_CACHE_MAGIC, sizeof(hdr.magic)) == 0
+             && hdr.width > 0 && hdr.height > 0
+             && hdr.width <= 65536 && hdr.height <= 65536
+             && hdr.n_channels == (hdr.has_alpha ? 4u : 3u)
+             && hdr.rowstride == hdr.width * hdr.n_channels
+             && (guint64)st.st_size == sizeof(hdr) + (guint64)hdr.rowstride * hdr.height);
+    close(fd);
+    if(!valid)
+    {
+        g_unlink(job->cache_file);
+        return NULL;
+    }
+    /* the file is replaced only by rename() so the mapped one stays intact */
+    mf = g_mapped_file_new(job->cache_file, FALSE, NULL);
+    if(mf == NULL)
+        return NULL;
+    data = g_mapped_file_get_contents(mf);
+    if(g_mapped_file_get_length(mf) != (gsize)st.st_size
+       || memcmp(data, &hdr, sizeof(hdr)) != 0)
+    {
+        _bg_mapped_file_free(NULL, mf);
+        return NULL;
+    }
+    pix = gdk_pixbuf_new_from_data((const guchar*)data + sizeof(hdr),
+                                   GDK_COLORSPACE_RGB, hdr.has_alpha != 0, 8,
+                                   hdr.width, hdr.height, hdr.rowstride,
+                                   _bg_mapped_file_free, mf);
+    /* mark it as recently used for _bg_disk_cache_prune() */
+    g_utime(job->cache_file, NULL);
+    return pix;
+}
+
+static gint _bg_disk_cache_compare(gconstpointer a, gconstpointer b)
+{
+    const struct stat *sa = a, *sb = b;
+
+    return (sa->st_mtime > sb->st_mtime) ? -1 : (sa->st_mtime < sb->st_mtime);
+}
+
+/* removes least recently used files above BG_DISK_CACHE_MAX files or
+   BG_DISK_CACHE_MAX_SIZE bytes */
+static void _bg_disk_cache_prune(const char *dir_path)
+{
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    GArray *files;
+    const char *name;
+    char *path;
+    struct stat st;
+    guint i, keep;
+    goffset size = 0;
+
+    if(dir == NULL)
+        return;
+    files = g_array_new(FALSE, FALSE, sizeof(struct stat));
+    while((name = g_dir_read_name(dir)) != NULL)
+    {
+        if(!g_str_has_suffix(name, ".raw"))
+            continue;
+        path = g_build_filename(dir_path, name, NULL);
+        if(g_stat(path, &st) == 0)
+            g_array_append_val(files, st);
+        g_free(path);
+    }
+    g_array_sort(files, _bg_disk_cache_compare);
+    for(keep = 0; keep < files->len && keep < BG_DISK_CACHE_MAX; keep++)
+    {
+        size += g_array_index(files, struct stat, keep).st_size;
+        if(size > BG_DISK_CACHE_MAX_SIZE)
+            break;
+    }
+    if(files->len > keep)
+    {
+        g_dir_rewind(dir);
+        /* find names for the oldest ones by inode */
+        while((name = g_dir_read_name(dir)) != NULL)
+        {
+            if(!g_str_has_suffix(name, ".raw"))
+                continue;
+            path = g_build_filename(dir_path, name, NULL);
+            if(g_stat(path, &st) == 0)
+                for(i = keep; i < files->len; i++)
+                    if(g_array_index(files, struct stat, i).st_ino == st.st_ino)
+                    {
+                        g_unlink(path);
+                        break;
+                    }
+            g_free(path);
+        }
+    }
+    g_array_free(files, TRUE);
+    g_dir_close(dir);
+}
+
+/* writes scaled image into the cache, runs in the worker thread */
+static void _bg_disk_cache_save(FmBackgroundJob *job, GdkPixbuf *pix)
+{
+    FmBackgroundFileHeader hdr;
+    const guchar *pixels;
+    char *dir, *tmp;
+    FILE *f;
+    int fd, stride;
+    guint i;
+
+    if(job->cache_file == NULL || gdk_pixbuf_get_bits_per_sample(pix) != 8)
+        return;
+    /* image which alone takes most of the cache isn't worth to keep */
+    if((gsize)gdk_pixbuf_get_width(pix) * gdk_pixbuf_get_height(pix)
+       * gdk_pixbuf_get_n_channels(pix) > BG_DISK_CACHE_MAX_SIZE / 4)
+        return;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BG_DISK_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.width = gdk_pixbuf_get_width(pix);
+    hdr.height = gdk_pixbuf_get_height(pix);
+    hdr.n_channels = gdk_pixbuf_get_n_channels(pix);
+    hdr.has_alpha = gdk_pixbuf_get_has_alpha(pix);
+    hdr.rowstride = hdr.width * hdr.n_channels;
+    if(hdr.n_channels != (hdr.has_alpha ? 4u : 3u))
+        return;
+    dir = g_path_get_dirname(job->cache_file);
+    g_mkdir_with_parents(dir, 0700);
+    tmp = g_strconcat(job->cache_file, ".XXXXXX", NULL);
+    fd = g_mkstemp(tmp);
+    if(fd < 0 || (f = fdopen(fd, "wb")) == NULL)
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+            g_unlink(tmp);
+        }
+        goto _out;
+    }
+    pixels = gdk_pixbuf_get_pixels(pix);
+    stride = gdk_pixbuf_get_rowstride(pix);
+    /* rows are stored without padding, rowstride may be bigger */
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    for(i = 0; i < hdr.height; i++)
+        if(fwrite(pixels + (gsize)i * stride, hdr.rowstride, 1, f) != 1)
+            break;
+    if(fclose(f) != 0 || i < hdr.height || g_rename(tmp, job->cache_file) != 0)
+        g_unlink(tmp);
+    else
+        _bg_disk_cache_prune(dir);
+_out:
+    g_free(tmp);
+    g_free(dir);
 }
 
-static void _clear_bg_cache(FmDesktop *self)
+/* scales the image as required by mode, runs in the worker thread */
+static GdkPixbuf *_bg_scale_image(FmBackgroundJob *job, GdkPixbuf *pix)
 {
-    while(self->cache)
+    GdkPixbuf *scaled;
+    int src_w = gdk_pixbuf_get_width(pix);
+    int src_h = gdk_pixbuf_get_height(pix);
+
+    switch(job->wallpaper_mode)
     {
-        FmBackgroundCache *bg = self->cache;
+    case FM_WP_STRETCH:
+    case FM_WP_SCREEN:
+        if(job->dest_w != src_w || job->dest_h != src_h)
+        {
+            scaled = image_ops_scale(pix, job->dest_w, job->dest_h, job->scale_mode);
+            g_object_unref(pix);
+            pix = scaled;
+        }
+        break;
+    case FM_WP_FIT:
+    case FM_WP_CROP:
+        if(job->dest_w != src_w || job->dest_h != src_h)
+        {
+            gdouble w_ratio = (float)job->dest_w / src_w;
+            gdouble h_ratio = (float)job->dest_h / src_h;
+            gdouble ratio = (job->wallpaper_mode == FM_WP_FIT)
+                ? MIN(w_ratio, h_ratio)
+                : MAX(w_ratio, h_ratio);
+            if(ratio != 1.0)
+            {
+                src_w *= ratio;
+                src_h *= ratio;
+                scaled = image_ops_scale(pix, src_w, src_h, job->scale_mode);
+                g_object_unref(pix);
+                pix = scaled;
+            }
+        }
+        break;
+    case FM_WP_TILE:
+    case FM_WP_CENTER:
+    case FM_WP_COLOR: ; /* handled in update_background() */
+    }
+    return pix;
+}
 
-        self->cache = bg->next;
-        _free_cache_image(bg);
-        g_free(bg->filename);
-        g_free(bg);
+/* loads and scales the image, runs in the worker thread */
+static void _bg_job_run(gpointer data, gpointer unused)
+{
+    FmBackgroundJob *job = data;
+    GdkPixbuf *pix;
+    int src_w, src_h;
+
+    if(g_cancellable_is_cancelled(job->cancellable))
+        goto _finish;
+    pix = _bg_disk_cache_load(job);
+    if(pix == NULL)
+    {
+        pix = gdk_pixbuf_new_from_file(job->filename, NULL);
+        if(pix == NULL)
+            goto _finish;
+        if(g_cancellable_is_cancelled(job->cancellable))
+        {
+            g_object_unref(pix);
+            goto _finish;
+        }
+        src_w = gdk_pixbuf_get_width(pix);
+        src_h = gdk_pixbuf_get_height(pix);
+        pix = _bg_scale_image(job, pix);
+        /* only scaled images are saved, decoding alone is cheap enough */
+        if(pix && !g_cancellable_is_cancelled(job->cancellable)
+           && (gdk_pixbuf_get_width(pix) != src_w || gdk_pixbuf_get_height(pix) != src_h))
+            _bg_disk_cache_save(job, pix);
     }
+    if(pix == NULL || g_cancellable_is_cancelled(job->cancellable))
+    {
+        if(pix)
+            g_object_unref(pix);
+        goto _finish;
+    }
+    job->fill_bg = (gdk_pixbuf_get_has_alpha(pix)
+                    || job->wallpaper_mode == FM_WP_CENTER
+                    || job->wallpaper_mode == FM_WP_FIT);
+    switch(job->wallpaper_mode)
+    {
+    case FM_WP_FIT:
+    case FM_WP_CROP:
+    case FM_WP_CENTER:
+        job->x = (job->dest_w - gdk_pixbuf_get_width(pix))/2;
+        job->y = (job->dest_h - gdk_pixbuf_get_height(pix))/2;
+        break;
+    default:
+        job->x = -job->ox;
+        job->y = -job->oy;
+    }
+    job->pix = pix;
+_finish:
+    gdk_threads_add_idle(_bg_job_finished, job);
 }
 
 static void update_background(FmDesktop* desktop, int is_it)
 {
     GtkWidget* widget = (GtkWidget*)desktop;
-    GdkPixbuf* pix, *scaled;
-    cairo_t* cr;
     GdkScreen *screen = gtk_widget_get_screen(widget);
-    GdkWindow* root = gdk_screen_get_root_window(screen);
-    GdkWindow *window = gtk_widget_get_window(widget);
     FmBackgroundCache *cache;
-#if GTK_CHECK_VERSION(3, 0, 0)
-    cairo_pattern_t *pattern;
-#endif
-
-    Display* xdisplay;
-    Pixmap xpixmap;
-    Window xroot;
-    int screen_num = gdk_screen_get_number(screen);
-
-    char *wallpaper;
+    FmBackgroundJob *job;
+    GdkRectangle geom;
+    int dest_w, dest_h, ox = 0, oy = 0;
+    struct stat st; /* for mtime */
+    char *wallpaper, *key;
 
     if (!desktop->conf.wallpaper_common)
     {
@@ -2148,27 +3845,10 @@ static void update_background(FmDesktop* desktop, int is_it)
                 desktop->conf.wallpapers[cur_desktop] = NULL;
                 desktop->conf.wallpapers_configured = cur_desktop + 1;
             }
-            /* free old image if it's not used anymore */
+            /* old image will be freed by _prune_bg_cache() if not used */
             else if (g_strcmp0(desktop->conf.wallpapers[cur_desktop], wallpaper))
             {
-                wallpaper = desktop->conf.wallpapers[cur_desktop];
-                if (wallpaper)
-                {
-                    for (i = 0; i < desktop->conf.wallpapers_configured; i++)
-                        if (i != (int)cur_desktop && /* test if it's used */
-                            g_strcmp0(desktop->conf.wallpapers[i], wallpaper) == 0)
-                            break;
-                    if (i == desktop->conf.wallpapers_configured) /* no matches */
-                    {
-                        for (cache = desktop->cache; cache; cache = cache->next)
-                            if (strcmp(wallpaper, cache->filename) == 0)
-                                break;
-                        if (cache)
-                            _free_cache_image(cache);
-                    }
-                    g_free(wallpaper);
-                }
-                wallpaper = desktop->conf.wallpaper;
+                g_free(desktop->conf.wallpapers[cur_desktop]);
                 desktop->conf.wallpapers[cur_desktop] = g_strdup(wallpaper);
             }
         }
@@ -2202,229 +3882,70 @@ static void update_background(FmDesktop* desktop, int is_it)
         }
     }
     else
-    {
-        _clear_bg_cache(desktop);
         wallpaper = desktop->conf.wallpaper;
-    }
-
-    if(desktop->conf.wallpaper_mode != FM_WP_COLOR && wallpaper && *wallpaper)
-    {
-        struct stat st; /* for mtime */
-
-        /* bug #3613571 - replacing the file will not affect the desktop
-           we will call stat on each desktop change but it's inevitable */
-        if (stat(wallpaper, &st) < 0)
-            st.st_mtime = 0;
-        for(cache = desktop->cache; cache; cache = cache->next)
-            if(strcmp(wallpaper, cache->filename) == 0)
-                break;
-        if(cache && cache->wallpaper_mode == desktop->conf.wallpaper_mode
-           && st.st_mtime == cache->mtime)
-            pix = NULL; /* no new pix for it */
-        else if((pix = gdk_pixbuf_new_from_file(wallpaper, NULL)))
-        {
-            if(cache)
-            {
-                /* the same file but mode was changed */
-                _free_cache_image(cache);
-            }
-            else if(desktop->cache)
-            {
-                for(cache = desktop->cache; cache->next; )
-                    cache = cache->next;
-                cache->next = g_new0(FmBackgroundCache, 1);
-                cache = cache->next;
-            }
-            else
-                desktop->cache = cache = g_new0(FmBackgroundCache, 1);
-            if(!cache->filename)
-                cache->filename = g_strdup(wallpaper);
-            cache->mtime = st.st_mtime;
-            g_debug("adding new FmBackgroundCache for %s", wallpaper);
-        }
-        else
-            /* if there is a cached image but with another mode and we cannot
-               get it from file for new mode then just leave it in cache as is */
-            cache = NULL;
-    }
-    else
-        cache = NULL;
 
-    if(!cache) /* solid color only */
+    /* the newest request wins, drop any image being prepared */
+    _bg_job_cancel(desktop);
+    if(desktop->conf.wallpaper_mode == FM_WP_COLOR || !wallpaper || !*wallpaper)
     {
-#if GTK_CHECK_VERSION(3, 0, 0)
-        pattern = cairo_pattern_create_rgb(desktop->conf.desktop_bg.red / 65535.0,
-                                           desktop->conf.desktop_bg.green / 65535.0,
-                                           desktop->conf.desktop_bg.blue / 65535.0);
-        gdk_window_set_background_pattern(window, pattern);
-        cairo_pattern_destroy(pattern);
-#else
-        GdkColor bg = desktop->conf.desktop_bg;
-
-        gdk_colormap_alloc_color(gdk_drawable_get_colormap(window), &bg, FALSE, TRUE);
-        gdk_window_set_back_pixmap(window, NULL, FALSE);
-        gdk_window_set_background(window, &bg);
-#endif
-        gdk_window_invalidate_rect(window, NULL, TRUE);
+        _bg_color_apply(desktop); /* solid color only */
         return;
     }
 
-    if(!cache->bg) /* no cached image found */
+    /* bug #3613571 - replacing the file will not affect the desktop
+       we will call stat on each desktop change but it's inevitable */
+    if (stat(wallpaper, &st) < 0)
+        st.st_mtime = 0;
+    if (desktop->conf.wallpaper_mode == FM_WP_TILE)
+        dest_w = dest_h = 0; /* size of image itself */
+    else
     {
-        int src_w, src_h;
-        int dest_w, dest_h;
-        int x = 0, y = 0;
-        src_w = gdk_pixbuf_get_width(pix);
-        src_h = gdk_pixbuf_get_height(pix);
-        if(desktop->conf.wallpaper_mode == FM_WP_TILE)
+        gdk_screen_get_monitor_geometry(screen, desktop->monitor, &geom);
+        if (desktop->conf.wallpaper_mode == FM_WP_SCREEN)
         {
-            dest_w = src_w;
-            dest_h = src_h;
+            dest_w = gdk_screen_get_width(screen);
+            dest_h = gdk_screen_get_height(screen);
+            ox = geom.x;
+            oy = geom.y;
         }
         else
         {
-            GdkRectangle geom;
-            gdk_screen_get_monitor_geometry(screen, desktop->monitor, &geom);
-            if (desktop->conf.wallpaper_mode == FM_WP_SCREEN)
-            {
-                dest_w = gdk_screen_get_width(screen);
-                dest_h = gdk_screen_get_height(screen);
-                x = -geom.x;
-                y = -geom.y;
-            }
-            else
-            {
-                dest_w = geom.width;
-                dest_h = geom.height;
-            }
-        }
-#if GTK_CHECK_VERSION(3, 0, 0)
-        xdisplay = GDK_WINDOW_XDISPLAY(root);
-        /* this code is taken from libgnome-desktop */
-        xpixmap = XCreatePixmap(xdisplay, RootWindow(xdisplay, screen_num),
-                                dest_w, dest_h, DefaultDepth(xdisplay, screen_num));
-        cache->bg = cairo_xlib_surface_create(xdisplay, xpixmap,
-                                              GDK_VISUAL_XVISUAL(gdk_screen_get_system_visual(screen)),
-                                              dest_w, dest_h);
-        cr = cairo_create(cache->bg);
-#else
-        cache->bg = gdk_pixmap_new(window, dest_w, dest_h, -1);
-        cr = gdk_cairo_create(cache->bg);
-#endif
-        if(gdk_pixbuf_get_has_alpha(pix)
-            || desktop->conf.wallpaper_mode == FM_WP_CENTER
-            || desktop->conf.wallpaper_mode == FM_WP_FIT)
-        {
-            gdk_cairo_set_source_color(cr, &desktop->conf.desktop_bg);
-            cairo_rectangle(cr, 0, 0, dest_w, dest_h);
-            cairo_fill(cr);
+            dest_w = geom.width;
+            dest_h = geom.height;
         }
-
-        switch(desktop->conf.wallpaper_mode)
-        {
-        case FM_WP_TILE:
-            break;
-        case FM_WP_STRETCH:
-        case FM_WP_SCREEN:
-            if(dest_w == src_w && dest_h == src_h)
-                scaled = (GdkPixbuf*)g_object_ref(pix);
-            else
-                scaled = gdk_pixbuf_scale_simple(pix, dest_w, dest_h, GDK_INTERP_BILINEAR);
-            g_object_unref(pix);
-            pix = scaled;
-            break;
-        case FM_WP_FIT:
-        case FM_WP_CROP:
-            if(dest_w != src_w || dest_h != src_h)
-            {
-                gdouble w_ratio = (float)dest_w / src_w;
-                gdouble h_ratio = (float)dest_h / src_h;
-                gdouble ratio = (desktop->conf.wallpaper_mode == FM_WP_FIT)
-                    ? MIN(w_ratio, h_ratio)
-                    : MAX(w_ratio, h_ratio);
-                if(ratio != 1.0)
-                {
-                    src_w *= ratio;
-                    src_h *= ratio;
-                    scaled = gdk_pixbuf_scale_simple(pix, src_w, src_h, GDK_INTERP_BILINEAR);
-                    g_object_unref(pix);
-                    pix = scaled;
-                }
-            }
-            /* continue to execute code in case FM_WP_CENTER */
-        case FM_WP_CENTER:
-            x = (dest_w - src_w)/2;
-            y = (dest_h - src_h)/2;
-            break;
-        case FM_WP_COLOR: ; /* handled above */
-        }
-        gdk_cairo_set_source_pixbuf(cr, pix, x, y);
-        cairo_paint(cr);
-        cairo_destroy(cr);
-        cache->wallpaper_mode = desktop->conf.wallpaper_mode;
     }
-#if GTK_CHECK_VERSION(3, 0, 0)
-    pattern = cairo_pattern_create_for_surface(cache->bg);
-    gdk_window_set_background_pattern(window, pattern);
-    cairo_pattern_destroy(pattern);
-#else
-    gdk_window_set_back_pixmap(window, cache->bg, FALSE);
-#endif
-
-    /* set root map here */
-    xdisplay = GDK_WINDOW_XDISPLAY(root);
-    xroot = RootWindow(xdisplay, screen_num);
-
-#if GTK_CHECK_VERSION(3, 0, 0)
-    xpixmap = cairo_xlib_surface_get_drawable(cache->bg);
-#else
-    xpixmap = GDK_WINDOW_XWINDOW(cache->bg);
-#endif
-
-    XChangeProperty(xdisplay, GDK_WINDOW_XID(root),
-                    XA_XROOTMAP_ID, XA_PIXMAP, 32, PropModeReplace, (guchar*)&xpixmap, 1);
-
-    XGrabServer (xdisplay);
-
-#if 0
-    result = XGetWindowProperty (display,
-                                 RootWindow (display, screen_num),
-                                 gdk_x11_get_xatom_by_name ("ESETROOT_PMAP_ID"),
-                                 0L, 1L, False, XA_PIXMAP,
-                                 &type, &format, &nitems,
-                                 &bytes_after,
-                                 &data_esetroot);
-
-    if (data_esetroot != NULL) {
-            if (result == Success && type == XA_PIXMAP &&
-                format == 32 &&
-                nitems == 1) {
-                    gdk_error_trap_push ();
-                    XKillClient (display, *(Pixmap *)data_esetroot);
-                    gdk_error_trap_pop_ignored ();
-            }
-            XFree (data_esetroot);
+    key = _bg_cache_key(screen, wallpaper, st.st_mtime,
+                        desktop->conf.wallpaper_mode, app_config->wallpaper_scale,
+                        dest_w, dest_h, ox, oy, &desktop->conf.desktop_bg);
+    cache = _bg_cache_lookup(key);
+    if(cache) /* no new pix for it */
+    {
+        g_free(key);
+        _bg_cache_hold(desktop, cache);
+        _bg_cache_apply(desktop, cache);
+        return;
     }
 
-    XChangeProperty (display, RootWindow (display, screen_num),
-                     gdk_x11_get_xatom_by_name ("ESETROOT_PMAP_ID"),
-                     XA_PIXMAP, 32, PropModeReplace,
-                     (guchar *) &xpixmap, 1);
-#endif
-
-    XChangeProperty(xdisplay, xroot, XA_XROOTPMAP_ID, XA_PIXMAP, 32,
-                    PropModeReplace, (guchar*)&xpixmap, 1);
-
-    XSetWindowBackgroundPixmap(xdisplay, xroot, xpixmap);
-    XClearWindow(xdisplay, xroot);
-
-    XFlush(xdisplay);
-    XUngrabServer(xdisplay);
-
-    if(pix)
-        g_object_unref(pix);
-
-    gdk_window_invalidate_rect(window, NULL, TRUE);
+    /* decode and scale the image in the worker thread, the old background
+       will be kept until _bg_job_finished() puts new one instead */
+    if(G_UNLIKELY(wallpaper_pool == NULL))
+        wallpaper_pool = g_thread_pool_new(_bg_job_run, NULL, 1, FALSE, NULL);
+    job = g_slice_new0(FmBackgroundJob);
+    job->desktop = g_object_ref(desktop);
+    job->cancellable = g_cancellable_new();
+    job->filename = g_strdup(wallpaper);
+    job->mtime = st.st_mtime;
+    job->wallpaper_mode = desktop->conf.wallpaper_mode;
+    job->bg_color = desktop->conf.desktop_bg;
+    job->dest_w = dest_w;
+    job->dest_h = dest_h;
+    job->scale_mode = app_config->wallpaper_scale;
+    job->ox = ox;
+    job->oy = oy;
+    job->cache_file = _bg_disk_cache_file(job);
+    job->key = key;
+    desktop->bg_job = job;
+    g_thread_pool_push(wallpaper_pool, job, NULL);
 }
 
 
@@ -2436,12 +3957,19 @@ static void on_row_deleting(FmFolderModel* model, GtkTreePath* tp,
 {
     GList *l;
 
+    /* the navigation index and search should not refer the item anymore */
+    desktop->nav_valid = FALSE;
+    desktop->search_matches_valid = FALSE;
     for(l = desktop->fixed_items; l; l = l->next)
         if(l->data == data)
         {
             desktop->fixed_items = g_list_delete_link(desktop->fixed_items, l);
+            /* the place is freed so other items may be moved into it */
+            queue_layout_items(desktop);
             break;
         }
+    if (((FmDesktopItem*)data)->in_grid)
+        redraw_item(desktop, data);
     if((gpointer)desktop->focus == data)
     {
         GtkTreeIter it = *iter;
@@ -2468,9 +3996,12 @@ static void on_row_deleting(FmFolderModel* model, GtkTreePath* tp,
     {
         desktop->hover_item = NULL;
         /* bug #3615015: after deleting the item tooltip stuck on the desktop */
-        g_object_set(G_OBJECT(desktop), "tooltip-text", NULL, NULL);
+        gtk_widget_trigger_tooltip_query(GTK_WIDGET(desktop));
     }
-    fm_desktop_accessible_item_deleted(desktop, data);
+    fm_desktop_accessible_item_deleted(desktop, data, gtk_tree_path_get_indices(tp)[0]);
+    set_item_selected(desktop, data, FALSE);
+    desktop_grid_remove(desktop, data);
+    drop_item_label(desktop, data);
     desktop_item_free(data);
 }
 
@@ -2480,12 +4011,15 @@ static void on_row_inserted(FmFolderModel* mod, GtkTreePath* tp, GtkTreeIter* it
     gint *indices = gtk_tree_path_get_indices(tp);
     fm_desktop_accessible_item_added(desktop, item, indices[0]);
     fm_folder_model_set_item_userdata(mod, it, item);
-    queue_layout_items(desktop);
+    desktop->nav_valid = FALSE;
+    desktop->search_matches_valid = FALSE;
+    queue_layout_items_from(desktop, indices[0], TRUE);
 }
 
 static void on_row_deleted(FmFolderModel* mod, GtkTreePath* tp, FmDesktop* desktop)
 {
-    queue_layout_items(desktop);
+    gint *indices = gtk_tree_path_get_indices(tp);
+    queue_layout_items_from(desktop, indices[0], FALSE);
 }
 
 static void on_row_changed(FmFolderModel* model, GtkTreePath* tp, GtkTreeIter* it, FmDesktop* desktop)
@@ -2498,19 +4032,32 @@ static void on_row_changed(FmFolderModel* model, GtkTreePath* tp, GtkTreeIter* i
                        FM_FOLDER_MODEL_COL_INFO, &item->fi,
                        FM_FOLDER_MODEL_COL_ICON, &icon, -1);
     fm_file_info_ref(item->fi);
+    g_free(item->search_key);
+    item->search_key = make_search_key(fm_file_info_get_disp_name(item->fi));
+    desktop->search_matches_valid = FALSE;
+    /* the label should be shaped again only if the name was changed */
+    if (item->pl && g_strcmp0(pango_layout_get_text(item->pl),
+                              fm_file_info_get_disp_name(item->fi)) != 0)
+    {
+        drop_item_label(desktop, item);
+        g_object_unref(item->pl);
+        item->pl = NULL;
+    }
 
     /* we need to redraw old area as we changing data */
     redraw_item(desktop, item);
     calc_item_size(desktop, item, icon);
     if (icon)
         g_object_unref(icon);
+    desktop_grid_update(desktop, item);
     redraw_item(desktop, item);
     /* queue_layout_items(desktop); */
 }
 
 static void on_rows_reordered(FmFolderModel* model, GtkTreePath* parent_tp, GtkTreeIter* parent_it, gpointer new_order, FmDesktop* desktop)
 {
-    fm_desktop_accessible_items_reordered(desktop, GTK_TREE_MODEL(model), new_order);
+    desktop->nav_valid = FALSE;
+    desktop->search_matches_valid = FALSE;
     queue_layout_items(desktop);
 }
 
@@ -2837,7 +4384,7 @@ static void on_fix_pos(GtkToggleAction* act, gpointer user_data)
         queue_layout_items(desktop);
     }
     g_list_free(items);
-    queue_config_save(desktop);
+    queue_item_pos_save(desktop);
 }
 
 #if FM_CHECK_VERSION(1, 2, 0)
@@ -2902,6 +4449,7 @@ static void on_snap_to_grid(GtkAction* act, gpointer user_data)
     g_list_free(items);
 
     queue_layout_items(desktop);
+    queue_item_pos_save(desktop);
 }
 
 
@@ -2915,16 +4463,16 @@ static gboolean is_point_in_rect(GdkRectangle* rect, int x, int y)
 
 static FmDesktopItem* hit_test(FmDesktop* self, GtkTreeIter *it, int x, int y)
 {
-    FmDesktopItem* item;
-    GtkTreeModel* model;
+    FmDesktopItem *item, *found = NULL;
+    GtkTreePath *tp, *found_tp = NULL;
+    GSList *l;
 
     if (!self->model)
         return NULL;
-    model = GTK_TREE_MODEL(self->model);
-    if(model && gtk_tree_model_get_iter_first(model, it)) do
+    for (l = desktop_grid_lookup(self, x, y); l; l = l->next)
     {
         GdkRectangle icon_rect;
-        item = fm_folder_model_get_item_userdata(self->model, it);
+        item = l->data;
         /* we cannot drop dragged items onto themselves */
         if (item->is_selected && self->dragging)
             continue;
@@ -2932,19 +4480,152 @@ static FmDesktopItem* hit_test(FmDesktop* self, GtkTreeIter *it, int x, int y)
            so let expand icon test area up to text_rect */
         icon_rect = item->icon_rect;
         icon_rect.height = item->text_rect.y - icon_rect.y;
-        if(is_point_in_rect(&icon_rect, x, y)
-         || is_point_in_rect(&item->text_rect, x, y))
-            return item;
+        if(!is_point_in_rect(&icon_rect, x, y)
+           && !is_point_in_rect(&item->text_rect, x, y))
+            continue;
+        if (found == NULL)
+        {
+            found = item;
+            continue;
+        }
+        /* items overlap, the first one in the model wins */
+        if (found_tp == NULL)
+            found_tp = gtk_tree_model_get_path(GTK_TREE_MODEL(self->model), &found->it);
+        tp = gtk_tree_model_get_path(GTK_TREE_MODEL(self->model), &item->it);
+        if (gtk_tree_path_compare(tp, found_tp) < 0)
+        {
+            gtk_tree_path_free(found_tp);
+            found_tp = tp;
+            found = item;
+        }
+        else
+            gtk_tree_path_free(tp);
     }
-    while(gtk_tree_model_iter_next(model, it));
-    return NULL;
+    if (found_tp)
+        gtk_tree_path_free(found_tp);
+    if (found)
+        *it = found->it;
+    return found;
+}
+
+/* ---------------------------------------------------------------------
+    Navigation index: items sorted by columns and by rows */
+
+static gint _nav_compare_x(gconstpointer a, gconstpointer b)
+{
+    const FmDesktopItem *item = *(FmDesktopItem * const *)a;
+    const FmDesktopItem *item2 = *(FmDesktopItem * const *)b;
+
+    if (item->area.x != item2->area.x)
+        return (item->area.x < item2->area.x) ? -1 : 1;
+    if (item->area.y != item2->area.y)
+        return (item->area.y < item2->area.y) ? -1 : 1;
+    return (int)item->nav_index - (int)item2->nav_index;
+}
+
+static gint _nav_compare_y(gconstpointer a, gconstpointer b)
+{
+    const FmDesktopItem *item = *(FmDesktopItem * const *)a;
+    const FmDesktopItem *item2 = *(FmDesktopItem * const *)b;
+
+    if (item->area.y != item2->area.y)
+        return (item->area.y < item2->area.y) ? -1 : 1;
+    if (item->area.x != item2->area.x)
+        return (item->area.x < item2->area.x) ? -1 : 1;
+    return (int)item->nav_index - (int)item2->nav_index;
+}
+
+static void update_nav_index(FmDesktop* desktop)
+{
+    GtkTreeModel* model = GTK_TREE_MODEL(desktop->model);
+    FmDesktopItem* item;
+    GtkTreeIter it;
+    guint i, n;
+
+    if (desktop->nav_valid)
+        return;
+    n = (guint)gtk_tree_model_iter_n_children(model, NULL);
+    desktop->nav_by_x = g_renew(FmDesktopItem*, desktop->nav_by_x, n);
+    desktop->nav_by_y = g_renew(FmDesktopItem*, desktop->nav_by_y, n);
+    i = 0;
+    if (gtk_tree_model_get_iter_first(model, &it)) do
+    {
+        item = fm_folder_model_get_item_userdata(desktop->model, &it);
+        item->nav_index = i; /* model order to resolve ties */
+        desktop->nav_by_x[i] = desktop->nav_by_y[i] = item;
+        i++;
+    }
+    while (i < n && gtk_tree_model_iter_next(model, &it));
+    desktop->nav_len = i;
+    qsort(desktop->nav_by_x, i, sizeof(FmDesktopItem*), _nav_compare_x);
+    qsort(desktop->nav_by_y, i, sizeof(FmDesktopItem*), _nav_compare_y);
+    for (i = 0; i < desktop->nav_len; i++)
+        desktop->nav_by_x[i]->nav_pos = i;
+    desktop->nav_valid = TRUE;
+}
+
+static void free_nav_index(FmDesktop* desktop)
+{
+    g_free(desktop->nav_by_x);
+    g_free(desktop->nav_by_y);
+    desktop->nav_by_x = desktop->nav_by_y = NULL;
+    desktop->nav_len = 0;
+    desktop->nav_valid = FALSE;
+}
+
+#define NAV_MAJOR(item,by_y) ((by_y) ? (item)->area.y : (item)->area.x)
+#define NAV_MINOR(item,by_y) ((by_y) ? (item)->area.x : (item)->area.y)
+
+/* returns the first index in [lo, hi) where (major, minor) is not less */
+static guint _nav_lower_bound(FmDesktopItem** arr, guint lo, guint hi,
+                              gboolean by_y, int major, int minor)
+{
+    guint mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (NAV_MAJOR(arr[mid], by_y) < major ||
+            (NAV_MAJOR(arr[mid], by_y) == major && NAV_MINOR(arr[mid], by_y) < minor))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* picks the item in run [start, end) of the same column (or row) which is
+   the nearest to minor, the first in model order if there are few */
+static FmDesktopItem* _nav_pick(FmDesktopItem** arr, guint start, guint end,
+                                gboolean by_y, int minor)
+{
+    int major = NAV_MAJOR(arr[start], by_y);
+    guint q = _nav_lower_bound(arr, start, end, by_y, major, minor);
+    FmDesktopItem *after = NULL, *before = NULL;
+    int d1, d2;
+
+    if (q < end)
+        after = arr[q];
+    if (q > start)
+        before = arr[_nav_lower_bound(arr, start, q, by_y, major,
+                                      NAV_MINOR(arr[q - 1], by_y))];
+    if (!before)
+        return after;
+    if (!after)
+        return before;
+    d1 = NAV_MINOR(after, by_y) - minor;
+    d2 = minor - NAV_MINOR(before, by_y);
+    if (d1 != d2)
+        return (d1 < d2) ? after : before;
+    return (after->nav_index < before->nav_index) ? after : before;
 }
 
 static FmDesktopItem* get_nearest_item(FmDesktop* desktop, FmDesktopItem* item,  GtkDirectionType dir)
 {
     GtkTreeModel* model;
-    FmDesktopItem* item2, *ret = NULL;
-    guint min_x_dist, min_y_dist, dist;
+    FmDesktopItem** arr;
+    gboolean by_y;
+    guint p, start, end, n;
     GtkTreeIter it;
 
     if (!desktop->model)
@@ -2955,121 +4636,37 @@ static FmDesktopItem* get_nearest_item(FmDesktop* desktop, FmDesktopItem* item,
     if(!item) /* there is no focused item yet, select first one then */
         return fm_folder_model_get_item_userdata(desktop->model, &it);
 
-    min_x_dist = min_y_dist = (guint)-1;
-    item2 = NULL;
+    update_nav_index(desktop);
+    n = desktop->nav_len;
+    if (n == 0)
+        return NULL;
+    by_y = (dir == GTK_DIR_UP || dir == GTK_DIR_DOWN);
+    arr = by_y ? desktop->nav_by_y : desktop->nav_by_x;
 
+    /* find the nearest column (or row) in the direction, then the item in it
+       which is the nearest to the item */
     switch(dir)
     {
     case GTK_DIR_LEFT:
-        do
-        {
-            item2 = fm_folder_model_get_item_userdata(desktop->model, &it);
-            if(item2->area.x >= item->area.x)
-                continue;
-            dist = item->area.x - item2->area.x;
-            if(dist < min_x_dist)
-            {
-                ret = item2;
-                min_x_dist = dist;
-                min_y_dist = ABS(item->area.y - item2->area.y);
-            }
-            else if(dist == min_x_dist && item2 != ret) /* if there is another item of the same x distance */
-            {
-                /* get the one with smaller y distance */
-                dist = ABS(item2->area.y - item->area.y);
-                if(dist < min_y_dist)
-                {
-                    ret = item2;
-                    min_y_dist = dist;
-                }
-            }
-        }
-        while(gtk_tree_model_iter_next(model, &it));
-        break;
-    case GTK_DIR_RIGHT:
-        do
-        {
-            item2 = fm_folder_model_get_item_userdata(desktop->model, &it);
-            if(item2->area.x <= item->area.x)
-                continue;
-            dist = item2->area.x - item->area.x;
-            if(dist < min_x_dist)
-            {
-                ret = item2;
-                min_x_dist = dist;
-                min_y_dist = ABS(item->area.y - item2->area.y);
-            }
-            else if(dist == min_x_dist && item2 != ret) /* if there is another item of the same x distance */
-            {
-                /* get the one with smaller y distance */
-                dist = ABS(item2->area.y - item->area.y);
-                if(dist < min_y_dist)
-                {
-                    ret = item2;
-                    min_y_dist = dist;
-                }
-            }
-        }
-        while(gtk_tree_model_iter_next(model, &it));
-        break;
     case GTK_DIR_UP:
-        do
-        {
-            item2 = fm_folder_model_get_item_userdata(desktop->model, &it);
-            if(item2->area.y >= item->area.y)
-                continue;
-            dist = item->area.y - item2->area.y;
-            if(dist < min_y_dist)
-            {
-                ret = item2;
-                min_y_dist = dist;
-                min_x_dist = ABS(item->area.x - item2->area.x);
-            }
-            else if(dist == min_y_dist && item2 != ret) /* if there is another item of the same y distance */
-            {
-                /* get the one with smaller x distance */
-                dist = ABS(item2->area.x - item->area.x);
-                if(dist < min_x_dist)
-                {
-                    ret = item2;
-                    min_x_dist = dist;
-                }
-            }
-        }
-        while(gtk_tree_model_iter_next(model, &it));
-        break;
-    case GTK_DIR_DOWN:
-        do
-        {
-            item2 = fm_folder_model_get_item_userdata(desktop->model, &it);
-            if(item2->area.y <= item->area.y)
-                continue;
-            dist = item2->area.y - item->area.y;
-            if(dist < min_y_dist)
-            {
-                ret = item2;
-                min_y_dist = dist;
-                min_x_dist = ABS(item->area.x - item2->area.x);
-            }
-            else if(dist == min_y_dist && item2 != ret) /* if there is another item of the same y distance */
-            {
-                /* get the one with smaller x distance */
-                dist = ABS(item2->area.x - item->area.x);
-                if(dist < min_x_dist)
-                {
-                    ret = item2;
-                    min_x_dist = dist;
-                }
-            }
-        }
-        while(gtk_tree_model_iter_next(model, &it));
-        break;
-    case GTK_DIR_TAB_FORWARD: /* FIXME */
-        break;
-    case GTK_DIR_TAB_BACKWARD: /* FIXME */
-        ;
+        p = _nav_lower_bound(arr, 0, n, by_y, NAV_MAJOR(item, by_y), G_MININT);
+        if (p == 0)
+            return NULL;
+        start = _nav_lower_bound(arr, 0, p, by_y, NAV_MAJOR(arr[p - 1], by_y), G_MININT);
+        return _nav_pick(arr, start, p, by_y, NAV_MINOR(item, by_y));
+    case GTK_DIR_RIGHT:
+    case GTK_DIR_DOWN:
+        p = _nav_lower_bound(arr, 0, n, by_y, NAV_MAJOR(item, by_y) + 1, G_MININT);
+        if (p == n)
+            return NULL;
+        end = _nav_lower_bound(arr, p, n, by_y, NAV_MAJOR(arr[p], by_y) + 1, G_MININT);
+        return _nav_pick(arr, p, end, by_y, NAV_MINOR(item, by_y));
+    case GTK_DIR_TAB_FORWARD: /* column by column, as items are placed */
+        return arr[(item->nav_pos + 1) % n];
+    case GTK_DIR_TAB_BACKWARD:
+        return arr[(item->nav_pos + n - 1) % n];
     }
-    return ret;
+    return NULL;
 }
 
 static void set_focused_item(FmDesktop* desktop, FmDesktopItem* item)
@@ -3093,7 +4690,7 @@ static void set_focused_item(FmDesktop* desktop, FmDesktopItem* item)
 
 static void _focus_and_select_focused_item(FmDesktop *desktop, FmDesktopItem *item)
 {
-    item->is_selected = TRUE;
+    set_item_selected(desktop, item, TRUE);
     fm_desktop_item_selected_changed(desktop, item);
     set_focused_item(desktop, item);
 }
@@ -3171,6 +4768,64 @@ static void forward_event_to_rootwin(GdkScreen *gscreen, GdkEvent *event)
 }
 
 
+typedef struct
+{
+    FmDesktopItem* item;
+    gint index; /* row in the model */
+    GdkRectangle area; /* part of the item within damaged area */
+} FmDesktopPaintItem;
+
+typedef struct
+{
+    GArray* items;
+    const GdkRectangle* rects;
+    gint n_rects;
+    guint visited; /* items tested, for debugging */
+} FmDesktopPaintData;
+
+static void _collect_paint_item(FmDesktop* self, FmDesktopItem* item, gpointer user_data)
+{
+    FmDesktopPaintData* data = user_data;
+    FmDesktopPaintItem pi;
+    GdkRectangle tmp;
+    GtkTreePath* tp;
+    gboolean found = FALSE;
+    gint i;
+
+    data->visited++;
+    for(i = 0; i < data->n_rects; i++)
+    {
+        if(gdk_rectangle_intersect(&data->rects[i], &item->icon_rect, &tmp))
+        {
+            if(found)
+                gdk_rectangle_union(&pi.area, &tmp, &pi.area);
+            else
+                pi.area = tmp;
+            found = TRUE;
+        }
+        if(gdk_rectangle_intersect(&data->rects[i], &item->text_rect, &tmp))
+        {
+            if(found)
+                gdk_rectangle_union(&pi.area, &tmp, &pi.area);
+            else
+                pi.area = tmp;
+            found = TRUE;
+        }
+    }
+    if(!found)
+        return;
+    pi.item = item;
+    tp = gtk_tree_model_get_path(GTK_TREE_MODEL(self->model), &item->it);
+    pi.index = gtk_tree_path_get_indices(tp)[0];
+    gtk_tree_path_free(tp);
+    g_array_append_val(data->items, pi);
+}
+
+static gint _paint_item_compare(gconstpointer a, gconstpointer b)
+{
+    return ((const FmDesktopPaintItem*)a)->index - ((const FmDesktopPaintItem*)b)->index;
+}
+
 #if GTK_CHECK_VERSION(3, 0, 0)
 static gboolean on_draw(GtkWidget* w, cairo_t* cr)
 #else
@@ -3178,12 +4833,19 @@ static gboolean on_expose(GtkWidget* w, GdkEventExpose* evt)
 #endif
 {
     FmDesktop* self = (FmDesktop*)w;
-#if !GTK_CHECK_VERSION(3, 0, 0)
+#if GTK_CHECK_VERSION(3, 0, 0)
+    cairo_rectangle_list_t* clips;
+#else
     cairo_t* cr;
 #endif
-    GtkTreeModel* model = self->model ? GTK_TREE_MODEL(self->model) : NULL;
-    GtkTreeIter it;
-    GdkRectangle area;
+    GdkRectangle area, *rects = NULL;
+    gint n_rects = 0, i;
+    GArray* items;
+    FmDesktopPaintData data;
+    gboolean cache_labels;
+#ifdef G_ENABLE_DEBUG
+    GTimer *timer;
+#endif
 
 #if GTK_CHECK_VERSION(3, 0, 0)
     if(G_UNLIKELY(!gtk_cairo_should_draw_window(cr, gtk_widget_get_window(w))))
@@ -3192,43 +4854,74 @@ static gboolean on_expose(GtkWidget* w, GdkEventExpose* evt)
     cairo_save(cr);
     gtk_cairo_transform_to_window(cr, w, gtk_widget_get_window(w));
     gdk_cairo_get_clip_rectangle(cr, &area);
+    clips = cairo_copy_clip_rectangle_list(cr);
+    if(clips->status == CAIRO_STATUS_SUCCESS)
+    {
+        n_rects = clips->num_rectangles;
+        rects = g_new(GdkRectangle, n_rects);
+        for(i = 0; i < n_rects; i++)
+        {
+            rects[i].x = floor(clips->rectangles[i].x);
+            rects[i].y = floor(clips->rectangles[i].y);
+            rects[i].width = ceil(clips->rectangles[i].x + clips->rectangles[i].width) - rects[i].x;
+            rects[i].height = ceil(clips->rectangles[i].y + clips->rectangles[i].height) - rects[i].y;
+        }
+    }
+    cairo_rectangle_list_destroy(clips);
 #else
     if(G_UNLIKELY(! gtk_widget_get_visible (w) || ! gtk_widget_get_mapped (w)))
         return TRUE;
 
     cr = gdk_cairo_create(gtk_widget_get_window(w));
     area = evt->area;
+    gdk_region_get_rectangles(evt->region, &rects, &n_rects);
+#endif
+#ifdef G_ENABLE_DEBUG
+    timer = g_timer_new();
 #endif
     if(self->rubber_bending)
         paint_rubber_banding_rect(self, cr, &area);
 
-    if(model && gtk_tree_model_get_iter_first(model, &it)) do
+    /* find items under damaged rectangles and paint them in model order
+       so overlapping items are stacked the same way as before */
+    items = g_array_new(FALSE, FALSE, sizeof(FmDesktopPaintItem));
+    data.visited = 0;
+    if(self->model)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(self->model, &it);
-        GdkRectangle* intersect, tmp, tmp2;
-        GdkPixbuf* icon = NULL;
-        if(gdk_rectangle_intersect(&area, &item->icon_rect, &tmp))
-            intersect = &tmp;
-        else
-            intersect = NULL;
-
-        if(gdk_rectangle_intersect(&area, &item->text_rect, &tmp2))
+        data.items = items;
+        if(n_rects > 0)
         {
-            if(intersect)
-                gdk_rectangle_union(intersect, &tmp2, intersect);
-            else
-                intersect = &tmp2;
+            data.rects = rects;
+            data.n_rects = n_rects;
         }
-
-        if(intersect)
+        else
         {
-            gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
-            paint_item(self, item, cr, intersect, icon);
-            if(icon)
-                g_object_unref(icon);
+            data.rects = &area;
+            data.n_rects = 1;
         }
+        desktop_grid_foreach(self, data.rects, data.n_rects, _collect_paint_item, &data);
+        if(items->len > 1)
+            g_array_sort(items, _paint_item_compare);
     }
-    while(gtk_tree_model_iter_next(model, &it));
+    cache_labels = use_label_cache(self, items->len);
+    for(i = 0; i < (gint)items->len; i++)
+    {
+        FmDesktopPaintItem* pi = &g_array_index(items, FmDesktopPaintItem, i);
+        GdkPixbuf* icon = NULL;
+
+        gtk_tree_model_get(GTK_TREE_MODEL(self->model), &pi->item->it,
+                           FM_FOLDER_MODEL_COL_ICON, &icon, -1);
+        paint_item(self, pi->item, cr, &pi->area, icon, cache_labels);
+        if(icon)
+            g_object_unref(icon);
+    }
+#ifdef G_ENABLE_DEBUG
+    g_debug("FmDesktop: expose of %d rectangles visited %u items, painted %u in %.3f ms",
+            n_rects, data.visited, items->len, g_timer_elapsed(timer, NULL) * 1000.0);
+    g_timer_destroy(timer);
+#endif
+    g_array_free(items, TRUE);
+    g_free(rects);
 #if GTK_CHECK_VERSION(3, 0, 0)
     cairo_restore(cr);
 #else
@@ -3270,6 +4963,8 @@ static void on_size_allocate(GtkWidget* w, GtkAllocation* alloc)
     self->pango_text_w = self->text_w * PANGO_SCALE;
     self->text_h += 4;
     self->text_w += 4; /* 4 is for drawing border */
+    /* font or label size might be changed so labels should be shaped again */
+    self->text_serial++;
     self->cell_h = fm_config->big_icon_size + self->spacing + self->text_h + self->ypad * 2;
     self->cell_w = MAX((gint)self->text_w, fm_config->big_icon_size) + self->xpad * 2;
 
@@ -3287,8 +4982,7 @@ static void on_size_allocate(GtkWidget* w, GtkAllocation* alloc)
         pango_font_description_free(font_desc);
 #endif
         /* bug #3614866: after monitor geometry was changed we need to redraw
-           the background invalidating all the cache */
-        _clear_bg_cache(self);
+           the background; cached images of another size will be replaced */
         if(self->conf.wallpaper_mode != FM_WP_COLOR && self->conf.wallpaper_mode != FM_WP_TILE)
             update_background(self, -1);
     }
@@ -3336,6 +5030,8 @@ static void _stop_rubberbanding(FmDesktop *self, gint x, gint y)
         g_signal_handlers_unblock_matched(G_OBJECT(self), G_SIGNAL_MATCH_DATA,
                                           0, 0, NULL, NULL, drag_data);
     }
+    /* drop pending motion, the final position is applied right now */
+    cancel_motion(self);
     self->rubber_bending = FALSE;
     update_rubberbanding(self, x, y);
     gtk_grab_remove(GTK_WIDGET(self));
@@ -3394,9 +5090,9 @@ static gboolean on_button_press(GtkWidget* w, GdkEventButton* evt)
         if(clicked_item)
         {
             if(evt->state & (GDK_SHIFT_MASK | GDK_CONTROL_MASK))
-                clicked_item->is_selected = ! clicked_item->is_selected;
+                set_item_selected(self, clicked_item, !clicked_item->is_selected);
             else
-                clicked_item->is_selected = TRUE;
+                set_item_selected(self, clicked_item, TRUE);
             fm_desktop_item_selected_changed(self, clicked_item);
 
             if(self->focus && self->focus != item)
@@ -3548,11 +5244,11 @@ static gboolean on_single_click_timeout(gpointer user_data)
     if (state == 0) /* no modifiers - drop selection and select this item */
     {
         _unselect_all(FM_FOLDER_VIEW(self));
-        item->is_selected = TRUE;
+        set_item_selected(self, item, TRUE);
     }
     else if (state == GDK_CONTROL_MASK) /* invert selection on the item */
     {
-        item->is_selected = ! item->is_selected;
+        set_item_selected(self, item, !item->is_selected);
     }
     else /* ignore other modifiers */
         return FALSE;
@@ -3562,64 +5258,55 @@ static gboolean on_single_click_timeout(gpointer user_data)
     return FALSE;
 }
 
-static gboolean on_motion_notify(GtkWidget* w, GdkEventMotion* evt)
+/* updates hovered item for the pointer position, see apply_motion() */
+static void update_hover(FmDesktop* self, int x, int y)
 {
-    FmDesktop* self = (FmDesktop*)w;
-    if(! self->button_pressed)
-    {
-        if(fm_config->single_click)
-        {
-            GtkTreeIter it;
-            FmDesktopItem* item = hit_test(self, &it, evt->x, evt->y);
-            FmDesktopItem *hover_item = self->hover_item;
-            GdkWindow* window;
+    GtkTreeIter it;
+    FmDesktopItem* item = hit_test(self, &it, x, y);
+    GdkWindow* window;
 
-            if(item != hover_item)
-            {
-                if(0 != self->single_click_timeout_handler)
-                {
-                    g_source_remove(self->single_click_timeout_handler);
-                    self->single_click_timeout_handler = 0;
-                }
-                window = gtk_widget_get_window(w);
-                self->hover_item = item;
-                if (hover_item)
-                    redraw_item(self, hover_item);
-                if(item)
-                {
-                    redraw_item(self, item);
-                    gdk_window_set_cursor(window, hand_cursor);
+    if(!fm_config->single_click)
+    {
+        self->hover_item = item;
+        return;
+    }
+    if(item == self->hover_item)
+        return;
+    if(0 != self->single_click_timeout_handler)
+    {
+        g_source_remove(self->single_click_timeout_handler);
+        self->single_click_timeout_handler = 0;
+    }
+    window = gtk_widget_get_window(GTK_WIDGET(self));
+    /* hovered item isn't drawn differently, only the tooltip
+       is changed, see on_query_tooltip() */
+    self->hover_item = item;
+    if(item)
+    {
+        gdk_window_set_cursor(window, hand_cursor);
 #if FM_CHECK_VERSION(1, 2, 0)
-                    if(fm_config->auto_selection_delay > 0)
-                        self->single_click_timeout_handler = gdk_threads_add_timeout(fm_config->auto_selection_delay,
-                                                                                     on_single_click_timeout, self);
+        if(fm_config->auto_selection_delay > 0)
+            self->single_click_timeout_handler = gdk_threads_add_timeout(fm_config->auto_selection_delay,
+                                                                         on_single_click_timeout, self);
 #else
-                    self->single_click_timeout_handler = gdk_threads_add_timeout(400, on_single_click_timeout, self); //400 ms
+        self->single_click_timeout_handler = gdk_threads_add_timeout(400, on_single_click_timeout, self); //400 ms
 #endif
-                        /* Making a loop to aviod the selection of the item */
-                        /* on_single_click_timeout(self); */
-                }
-                else
-                {
-                    gdk_window_set_cursor(window, NULL);
-                }
-            }
-        }
-        else
-        {
-            GtkTreeIter it;
-            FmDesktopItem* item = hit_test(self, &it, evt->x, evt->y);
-            FmDesktopItem *hover_item = self->hover_item;
+            /* Making a loop to aviod the selection of the item */
+            /* on_single_click_timeout(self); */
+    }
+    else
+    {
+        gdk_window_set_cursor(window, NULL);
+    }
+}
 
-            if(item != hover_item)
-            {
-                self->hover_item = item;
-                if (hover_item)
-                    redraw_item(self, hover_item);
-                if(item)
-                    redraw_item(self, item);
-            }
-        }
+static gboolean on_motion_notify(GtkWidget* w, GdkEventMotion* evt)
+{
+    FmDesktop* self = (FmDesktop*)w;
+    if(! self->button_pressed)
+    {
+        /* hit test is done later for the last position only */
+        queue_motion(self, evt->x, evt->y);
         return TRUE;
     }
 
@@ -3629,16 +5316,40 @@ static gboolean on_motion_notify(GtkWidget* w, GdkEventMotion* evt)
     }
     else if(self->rubber_bending)
     {
-        update_rubberbanding(self, evt->x, evt->y);
+        queue_motion(self, evt->x, evt->y);
     }
     /* we use auto-DnD so no DnD check is possible here */
 
     return TRUE;
 }
 
+static gboolean on_query_tooltip(GtkWidget* w, gint x, gint y,
+                                 gboolean keyboard_mode, GtkTooltip* tooltip)
+{
+    FmDesktop* self = (FmDesktop*)w;
+    FmDesktopItem* item = keyboard_mode ? self->focus : self->hover_item;
+    GdkRectangle rect;
+
+    if(item == NULL)
+        return FALSE;
+    gtk_tooltip_set_text(tooltip, fm_file_info_get_disp_name(item->fi));
+    /* let tooltip be queried again when pointer leaves the item */
+    get_item_rect(item, &rect);
+    gtk_tooltip_set_tip_area(tooltip, &rect);
+    return TRUE;
+}
+
 static gboolean on_leave_notify(GtkWidget* w, GdkEventCrossing *evt)
 {
     FmDesktop* self = (FmDesktop*)w;
+    /* hover should not be updated after pointer left */
+    if(!self->rubber_bending)
+        cancel_motion(self);
+#ifdef G_ENABLE_DEBUG
+    g_debug("FmDesktop: %u motion events received, %u processed, %u dropped",
+            self->motion_received, self->motion_processed,
+            self->motion_received - self->motion_processed);
+#endif
     if(self->single_click_timeout_handler)
     {
         g_source_remove(self->single_click_timeout_handler);
@@ -3707,6 +5418,13 @@ static void desktop_search_dialog_hide(GtkWidget *search_dialog, FmDesktop *desk
     send_focus_change(desktop->search_entry, FALSE);
     gtk_widget_hide(search_dialog);
     gtk_entry_set_text(GTK_ENTRY(desktop->search_entry), "");
+
+    /* forget candidates, next search will start from scratch */
+    desktop->search_matches_valid = FALSE;
+    if (desktop->search_matches)
+        g_ptr_array_set_size(desktop->search_matches, 0);
+    g_free(desktop->search_prefix);
+    desktop->search_prefix = NULL;
 }
 
 static gboolean desktop_search_delete_event(GtkWidget *widget, GdkEventAny *evt,
@@ -3731,15 +5449,60 @@ static void desktop_search_timeout_destroy(gpointer user_data)
     FM_DESKTOP(user_data)->search_timeout_id = 0;
 }
 
+/* fills desktop->search_matches with items which names start with key, in
+   the model order; if key only extends the previous one then previous
+   matches are narrowed instead of scanning the whole model again */
+static void desktop_search_update_matches(FmDesktop *desktop, const char *key)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL(desktop->model);
+    GPtrArray *matches;
+    FmDesktopItem *item;
+    GtkTreeIter it;
+    size_t len = strlen(key);
+    guint i, n;
+
+    if (desktop->search_matches == NULL)
+        desktop->search_matches = g_ptr_array_new();
+    matches = desktop->search_matches;
+    if (desktop->search_matches_valid && desktop->search_prefix &&
+        g_str_has_prefix(key, desktop->search_prefix))
+    {
+        for (i = n = 0; i < matches->len; i++)
+        {
+            item = g_ptr_array_index(matches, i);
+            if (strncmp(item->search_key, key, len) == 0)
+                g_ptr_array_index(matches, n++) = item;
+        }
+        g_ptr_array_set_size(matches, n);
+    }
+    else
+    {
+        g_ptr_array_set_size(matches, 0);
+        if (gtk_tree_model_get_iter_first(model, &it)) do
+        {
+            item = fm_folder_model_get_item_userdata(desktop->model, &it);
+            if (strncmp(item->search_key, key, len) == 0)
+                g_ptr_array_add(matches, item);
+        }
+        while (gtk_tree_model_iter_next(model, &it));
+    }
+    g_free(desktop->search_prefix);
+    desktop->search_prefix = g_strdup(key);
+    desktop->search_matches_valid = TRUE;
+}
+
 static void desktop_search_move(GtkWidget *widget, FmDesktop *desktop,
                                 gboolean move_up)
 {
     GtkTreeModel *model;
+    GPtrArray *matches;
     const gchar *text;
-    char *casefold, *key, *name;
+    char *key;
+    size_t len;
     FmDesktopItem *item;
     GtkTreeIter it;
     gboolean found = FALSE;
+    guint i;
 
     /* check if we have a model */
     if (desktop->model == NULL)
@@ -3756,11 +5519,25 @@ static void desktop_search_move(GtkWidget *widget, FmDesktop *desktop,
         return;
 
     /* normalize the pattern */
-    casefold = g_utf8_casefold(text, -1);
-    key = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-    g_free(casefold);
-    /* let find matched item now */
-    if (move_up)
+    key = make_search_key(text);
+    if (!desktop->search_matches_valid || strcmp(key, desktop->search_prefix) != 0)
+        desktop_search_update_matches(desktop, key);
+    len = strlen(key);
+    g_free(key);
+    /* if focused item is one of matches then just take its neighbour */
+    matches = desktop->search_matches;
+    for (i = 0; i < matches->len; i++)
+        if (g_ptr_array_index(matches, i) == desktop->focus)
+            break;
+    if (i < matches->len)
+    {
+        if (move_up ? i == 0 : i + 1 >= matches->len)
+            return;
+        item = g_ptr_array_index(matches, move_up ? i - 1 : i + 1);
+        found = TRUE;
+    }
+    /* otherwise let find matched item from the focused one */
+    else if (move_up)
     {
 #if GTK_CHECK_VERSION(3, 0, 0)
         while (!found && gtk_tree_model_iter_previous(model, &it))
@@ -3770,11 +5547,7 @@ static void desktop_search_move(GtkWidget *widget, FmDesktop *desktop,
 #endif
         {
             item = fm_folder_model_get_item_userdata(desktop->model, &it);
-            casefold = g_utf8_casefold(fm_file_info_get_disp_name(item->fi), -1);
-            name = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-            g_free(casefold);
-            found = (strncmp(name, key, strlen(key)) == 0);
-            g_free(name);
+            found = (strncmp(item->search_key, desktop->search_prefix, len) == 0);
         }
 #if !GTK_CHECK_VERSION(3, 0, 0)
         gtk_tree_path_free(tp);
@@ -3785,14 +5558,9 @@ static void desktop_search_move(GtkWidget *widget, FmDesktop *desktop,
         while (!found && gtk_tree_model_iter_next(model, &it))
         {
             item = fm_folder_model_get_item_userdata(desktop->model, &it);
-            casefold = g_utf8_casefold(fm_file_info_get_disp_name(item->fi), -1);
-            name = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-            g_free(casefold);
-            found = (strncmp(name, key, strlen(key)) == 0);
-            g_free(name);
+            found = (strncmp(item->search_key, desktop->search_prefix, len) == 0);
         }
     }
-    g_free(key);
 
     if (!found)
         return;
@@ -3937,17 +5705,12 @@ static void desktop_search_position(FmDesktop *desktop)
 
 static void desktop_search_init(GtkWidget *search_entry, FmDesktop *desktop)
 {
-    GtkTreeModel *model;
     const gchar *text;
-    char *casefold, *key, *name;
-    FmDesktopItem *item;
-    GtkTreeIter it;
-    gboolean found = FALSE;
+    char *key;
 
     /* check if we have a model */
     if (desktop->model == NULL)
         return;
-    model = GTK_TREE_MODEL(desktop->model);
 
     /* renew the flush timeout */
     desktop_search_update_timeout(desktop);
@@ -3961,26 +5724,15 @@ static void desktop_search_init(GtkWidget *search_entry, FmDesktop *desktop)
     _unselect_all(FM_FOLDER_VIEW(desktop));
 
     /* normalize the pattern */
-    casefold = g_utf8_casefold(text, -1);
-    key = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-    g_free(casefold);
+    key = make_search_key(text);
     /* find first matched item now */
-    if (gtk_tree_model_get_iter_first(model, &it)) do
-    {
-        item = fm_folder_model_get_item_userdata(desktop->model, &it);
-        casefold = g_utf8_casefold(fm_file_info_get_disp_name(item->fi), -1);
-        name = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-        g_free(casefold);
-        found = (strncmp(name, key, strlen(key)) == 0);
-        g_free(name);
-    }
-    while (!found && gtk_tree_model_iter_next(model, &it));
+    desktop_search_update_matches(desktop, key);
     g_free(key);
 
     /* focus found item */
-    if (!found)
+    if (desktop->search_matches->len == 0)
         return;
-    _focus_and_select_focused_item(desktop, item);
+    _focus_and_select_focused_item(desktop, g_ptr_array_index(desktop->search_matches, 0));
 }
 
 static void desktop_search_ensure_window(FmDesktop *desktop)
@@ -4111,7 +5863,7 @@ static gboolean on_key_press(GtkWidget* w, GdkEventKey* evt)
             if(0 == modifier)
             {
                 _unselect_all(FM_FOLDER_VIEW(desktop));
-                item->is_selected = TRUE;
+                set_item_selected(desktop, item, TRUE);
                 fm_desktop_item_selected_changed(desktop, item);
             }
             set_focused_item(desktop, item);
@@ -4124,7 +5876,7 @@ static gboolean on_key_press(GtkWidget* w, GdkEventKey* evt)
             if(0 == modifier)
             {
                 _unselect_all(FM_FOLDER_VIEW(desktop));
-                item->is_selected = TRUE;
+                set_item_selected(desktop, item, TRUE);
                 fm_desktop_item_selected_changed(desktop, item);
             }
             set_focused_item(desktop, item);
@@ -4137,7 +5889,7 @@ static gboolean on_key_press(GtkWidget* w, GdkEventKey* evt)
             if(0 == modifier)
             {
                 _unselect_all(FM_FOLDER_VIEW(desktop));
-                item->is_selected = TRUE;
+                set_item_selected(desktop, item, TRUE);
                 fm_desktop_item_selected_changed(desktop, item);
             }
             set_focused_item(desktop, item);
@@ -4150,7 +5902,24 @@ static gboolean on_key_press(GtkWidget* w, GdkEventKey* evt)
             if(0 == modifier)
             {
                 _unselect_all(FM_FOLDER_VIEW(desktop));
-                item->is_selected = TRUE;
+                set_item_selected(desktop, item, TRUE);
+                fm_desktop_item_selected_changed(desktop, item);
+            }
+            set_focused_item(desktop, item);
+        }
+        return TRUE;
+    case GDK_KEY_Tab:
+    case GDK_KEY_ISO_Left_Tab:
+        /* Shift+Tab walks backwards so Shift doesn't extend selection here */
+        item = get_nearest_item(desktop, desktop->focus,
+                                (modifier & GDK_SHIFT_MASK) ? GTK_DIR_TAB_BACKWARD
+                                                            : GTK_DIR_TAB_FORWARD);
+        if(item)
+        {
+            if(0 == (modifier & ~GDK_SHIFT_MASK))
+            {
+                _unselect_all(FM_FOLDER_VIEW(desktop));
+                set_item_selected(desktop, item, TRUE);
                 fm_desktop_item_selected_changed(desktop, item);
             }
             set_focused_item(desktop, item);
@@ -4161,7 +5930,7 @@ static gboolean on_key_press(GtkWidget* w, GdkEventKey* evt)
         {
             if(desktop->focus)
             {
-                desktop->focus->is_selected = !desktop->focus->is_selected;
+                set_item_selected(desktop, desktop->focus, !desktop->focus->is_selected);
                 redraw_item(desktop, desktop->focus);
                 fm_desktop_item_selected_changed(desktop, desktop->focus);
             }
@@ -4277,6 +6046,7 @@ static void on_direction_changed(GtkWidget* w, GtkTextDirection prev)
 {
     FmDesktop* self = (FmDesktop*)w;
     pango_layout_context_changed(self->pl);
+    self->text_serial++; /* labels should be shaped again */
     queue_layout_items(self);
 }
 
@@ -4312,6 +6082,7 @@ static void on_realize(GtkWidget* w)
     pc = gtk_widget_get_pango_context(w);
     pango_context_set_font_description(pc, font_desc);
     pango_font_description_free(font_desc);
+    self->text_serial++; /* labels should be shaped again */
 #if GTK_CHECK_VERSION(3, 0, 0)
     css_data = g_strdup_printf("FmDesktop {\n"
                                    "background-color: #%02x%02x%02x\n"
@@ -4480,95 +6251,155 @@ static void on_drag_data_received (GtkWidget *dest_widget,
     g_list_free(items);
 
     /* save position of desktop icons on next idle */
-    queue_config_save(desktop);
+    queue_item_pos_save(desktop);
 
     queue_layout_items(desktop);
 
     gtk_drag_finish(drag_context, TRUE, FALSE, time);
 }
 
+/* the drag icon shows all selected icons in place up to this number, for
+   bigger selection only few of them are stacked and a counter is shown */
+#define DRAG_ICON_MAX_ITEMS 8
+#define DRAG_ICON_STACK_ITEMS 4
+#define DRAG_ICON_STACK_STEP 6 /* offset between stacked icons, in pixels */
+
+/* draws number of dragged items in the top right corner */
+static void _draw_drag_badge(FmDesktop *desktop, cairo_t *cr, int width, guint n)
+{
+    GtkWidget *widget = GTK_WIDGET(desktop);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    GtkStyleContext *style = gtk_widget_get_style_context(widget);
+    GdkRGBA rgba;
+#else
+    GtkStyle *style = gtk_widget_get_style(widget);
+#endif
+    PangoLayout *pl;
+    PangoRectangle rc;
+    char text[16];
+    guint32 fg, bg;
+    int w, h;
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+    gtk_style_context_get_background_color(style, GTK_STATE_FLAG_SELECTED, &rgba);
+    bg = _pack_rgba(&rgba);
+    gtk_style_context_get_color(style, GTK_STATE_FLAG_SELECTED, &rgba);
+    fg = _pack_rgba(&rgba);
+#else
+    bg = _pack_color(&style->bg[GTK_STATE_SELECTED]);
+    fg = _pack_color(&style->fg[GTK_STATE_SELECTED]);
+#endif
+    g_snprintf(text, sizeof(text), "%u", n);
+    pl = gtk_widget_create_pango_layout(widget, text);
+    pango_layout_get_pixel_extents(pl, NULL, &rc);
+    h = rc.height + 4;
+    w = MAX(rc.width + h / 2, h);
+    /* rounded box with the text centered */
+    cairo_new_sub_path(cr);
+    cairo_arc(cr, width - h / 2.0, h / 2.0, h / 2.0, -G_PI / 2, G_PI / 2);
+    cairo_arc(cr, width - w + h / 2.0, h / 2.0, h / 2.0, G_PI / 2, 3 * G_PI / 2);
+    cairo_close_path(cr);
+    _set_source_packed(cr, bg);
+    cairo_fill(cr);
+    _set_source_packed(cr, fg);
+    cairo_move_to(cr, width - w + (w - rc.width) / 2 - rc.x, 2 - rc.y);
+    pango_cairo_show_layout(cr, pl);
+    g_object_unref(pl);
+}
+
 static GdkPixbuf *_create_drag_icon(FmDesktop *desktop, gint *x, gint *y)
 {
     GtkTreeModel *model;
-    FmDesktopItem *item;
+    FmDesktopItem *item, *items[DRAG_ICON_MAX_ITEMS];
+    GdkPixbuf *icons[DRAG_ICON_MAX_ITEMS];
     cairo_surface_t *s;
     GdkPixbuf *pixbuf;
     cairo_t *cr;
-    GdkPixbuf *icon;
     GtkTreeIter it;
     GdkRectangle area, icon_rect;
+    GList *l;
+    guint n, i, n_selected;
+    int w, h;
 #if !GTK_CHECK_VERSION(3, 0, 0)
     guchar *dest_data, *src_data;
-    int dest_stride, src_stride, _x, _y;
+    int dest_stride, src_stride;
 #endif
 
-    if (!desktop->model)
+    if (!desktop->model || !get_selection_area(desktop, &area))
         return NULL;
     model = GTK_TREE_MODEL(desktop->model);
-    if (!gtk_tree_model_get_iter_first(model, &it))
-        return NULL;
-
-    /* determine the size of complete pixbuf */
-    area.width = 0; /* mark it */
-    do
-    {
-        item = fm_folder_model_get_item_userdata(desktop->model, &it);
-        if (!item->is_selected)
-            continue;
-        if (area.width == 0)
-            area = item->icon_rect;
-        else
+    n_selected = desktop->selected.length;
+
+    /* collect icons to show: the item under pointer, then the last selected
+       ones, so the time doesn't depend on the number of selected items */
+    n = 0;
+    item = hit_test(desktop, &it, desktop->drag_start_x, desktop->drag_start_y);
+    if (item && item->is_selected)
+        items[n++] = item;
+    for (l = desktop->selected.tail; l && n < DRAG_ICON_MAX_ITEMS; l = l->prev)
+        if (n == 0 || l->data != items[0])
+            items[n++] = l->data;
+    if (n_selected > DRAG_ICON_MAX_ITEMS)
+        n = MIN(n, DRAG_ICON_STACK_ITEMS);
+    w = h = 0;
+    for (i = 0; i < n; i++)
+    {
+        icons[i] = NULL;
+        gtk_tree_model_get(model, &items[i]->it, FM_FOLDER_MODEL_COL_ICON, &icons[i], -1);
+        if (icons[i])
         {
-            if (item->icon_rect.x < area.x)
-            {
-                area.width += (area.x - item->icon_rect.x);
-                area.x = item->icon_rect.x;
-            }
-            if (item->icon_rect.x + item->icon_rect.width > area.x + area.width)
-                area.width = item->icon_rect.x + item->icon_rect.width - area.x;
-            if (item->icon_rect.y < area.y)
-            {
-                area.height += (area.y - item->icon_rect.y);
-                area.y = item->icon_rect.y;
-            }
-            if (item->icon_rect.y + item->icon_rect.height > area.y + area.height)
-                area.height = item->icon_rect.y + item->icon_rect.height - area.y;
+            w = MAX(w, gdk_pixbuf_get_width(icons[i]));
+            h = MAX(h, gdk_pixbuf_get_height(icons[i]));
         }
     }
-    while(gtk_tree_model_iter_next(model, &it));
 
     /* now create the pixbuf */
-    if (area.width == 0) /* no selection??? */
-        return NULL;
-    area.width += 2;
-    area.height += 2;
+    if (n_selected <= DRAG_ICON_MAX_ITEMS)
+    {
+        /* all icons in their places */
+        area.width += 2;
+        area.height += 2;
+    }
+    else
+    {
+        if (w == 0) /* no icons loaded */
+            w = h = fm_config->big_icon_size;
+        /* the icon under pointer is on top, others are behind it */
+        area.x = items[0]->icon_rect.x;
+        area.y = items[0]->icon_rect.y;
+        area.width = w + (n - 1) * DRAG_ICON_STACK_STEP;
+        area.height = h + (n - 1) * DRAG_ICON_STACK_STEP;
+    }
     s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, area.width, area.height);
     cr = cairo_create(s);
 
-    gtk_tree_model_get_iter_first(model, &it);
-    do
+    for (i = n; i-- > 0; )
     {
-        item = fm_folder_model_get_item_userdata(desktop->model, &it);
-        if (!item->is_selected)
-            continue;
         /* FIXME: should we render name too, or is it too heavy? */
-        icon = NULL;
-        gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
+        if (!icons[i])
+            continue;
         /* draw the icon */
-        if (icon)
+        if (n_selected <= DRAG_ICON_MAX_ITEMS)
         {
-            icon_rect.x = item->icon_rect.x - area.x + 1;
-            icon_rect.width = item->icon_rect.width;
-            icon_rect.y = item->icon_rect.y - area.y + 1;
-            icon_rect.height = item->icon_rect.height;
-//g_debug("icon at %d %d %d %d",icon_rect.x,icon_rect.y,icon_rect.width,icon_rect.height);
-            gdk_cairo_set_source_pixbuf(cr, icon, icon_rect.x, icon_rect.y);
-            gdk_cairo_rectangle(cr, &icon_rect);
-            cairo_fill(cr);
-            g_object_unref(icon);
+            icon_rect.x = items[i]->icon_rect.x - area.x + 1;
+            icon_rect.width = items[i]->icon_rect.width;
+            icon_rect.y = items[i]->icon_rect.y - area.y + 1;
+            icon_rect.height = items[i]->icon_rect.height;
+        }
+        else
+        {
+            icon_rect.width = gdk_pixbuf_get_width(icons[i]);
+            icon_rect.height = gdk_pixbuf_get_height(icons[i]);
+            icon_rect.x = i * DRAG_ICON_STACK_STEP + (w - icon_rect.width) / 2;
+            icon_rect.y = i * DRAG_ICON_STACK_STEP + (h - icon_rect.height) / 2;
         }
+        gdk_cairo_set_source_pixbuf(cr, icons[i], icon_rect.x, icon_rect.y);
+        gdk_cairo_rectangle(cr, &icon_rect);
+        cairo_fill(cr);
+        g_object_unref(icons[i]);
     }
-    while(gtk_tree_model_iter_next(model, &it));
+    if (n_selected > DRAG_ICON_MAX_ITEMS)
+        _draw_drag_badge(desktop, cr, area.width, n_selected);
 
     cairo_destroy (cr);
 #if GTK_CHECK_VERSION(3, 0, 0)
@@ -4585,31 +6416,8 @@ static GdkPixbuf *_create_drag_icon(FmDesktop *desktop, gint *x, gint *y)
     src_stride = cairo_image_surface_get_stride(s);
 
     /* convert alpha from cairo_surface_t into GdkPixbuf format */
-    for (_y = 0; _y < area.height; _y++)
-    {
-        guint32 *src = (guint32 *) src_data;
-
-        for (_x = 0; _x < area.width; _x++)
-        {
-            guint alpha = src[_x] >> 24;
-
-            if (alpha == 0)
-            {
-                dest_data[_x * 4 + 0] = 0;
-                dest_data[_x * 4 + 1] = 0;
-                dest_data[_x * 4 + 2] = 0;
-            }
-            else
-            {
-                dest_data[_x * 4 + 0] = (((src[_x] & 0xff0000) >> 16) * 255 + alpha / 2) / alpha;
-                dest_data[_x * 4 + 1] = (((src[_x] & 0x00ff00) >>  8) * 255 + alpha / 2) / alpha;
-                dest_data[_x * 4 + 2] = (((src[_x] & 0x0000ff) >>  0) * 255 + alpha / 2) / alpha;
-            }
-            dest_data[_x * 4 + 3] = alpha;
-        }
-        src_data += src_stride;
-        dest_data += dest_stride;
-    }
+    image_ops_unpremultiply(src_data, src_stride, dest_data, dest_stride,
+                            area.width, area.height);
 #endif
     cairo_surface_destroy(s);
     *x = area.x;
@@ -4782,6 +6590,7 @@ static inline void connect_model(FmDesktop *desktop, FmFolder *folder)
 static inline void disconnect_model(FmDesktop* desktop)
 {
     FmFolder *folder;
+    FmDesktopItem *item;
 
     if (desktop->model == NULL)
         return;
@@ -4798,9 +6607,17 @@ static inline void disconnect_model(FmDesktop* desktop)
 #if FM_CHECK_VERSION(1, 0, 2)
     g_signal_handlers_disconnect_by_func(desktop->model, on_sort_changed, desktop);
 #endif
+    fm_desktop_accessible_model_removed(desktop);
     g_object_unref(desktop->model);
     desktop->model = NULL;
-    fm_desktop_accessible_model_removed(desktop);
+    desktop->layout_done = FALSE;
+    desktop_grid_clear(desktop);
+    clear_label_cache(desktop);
+    free_nav_index(desktop);
+    desktop->search_matches_valid = FALSE;
+    /* items may outlive the model connection, don't keep stale links */
+    while ((item = g_queue_peek_head(&desktop->selected)) != NULL)
+        set_item_selected(desktop, item, FALSE);
     /* update popup now */
     fm_folder_view_add_popup(FM_FOLDER_VIEW(desktop), GTK_WINDOW(desktop),
                              fm_desktop_update_popup);
@@ -4819,6 +6636,7 @@ static void on_show_full_names_changed(FmConfig *cfg, FmDesktop *self)
         self->pango_text_h = self->text_h * PANGO_SCALE;
         pango_layout_set_ellipsize(self->pl, PANGO_ELLIPSIZE_END);
     }
+    self->text_serial++; /* labels should be shaped again */
     queue_layout_items(self);
 }
 #endif
@@ -4845,10 +6663,18 @@ static void fm_desktop_destroy(GtkObject *object)
 
         gtk_window_group_remove_window(win_group, (GtkWindow*)self);
 
+        /* save positions while items are still known */
+        if (self->pos_changed)
+            save_item_pos(self);
+        if (self->positions)
+            g_hash_table_destroy(self->positions);
+        self->positions = NULL;
+
         if (self->model)
             disconnect_model(self);
 
         unload_items(self);
+        desktop_grid_free(self);
 
         g_object_unref(self->icon_render);
         self->icon_render = NULL;
@@ -4860,16 +6686,26 @@ static void fm_desktop_destroy(GtkObject *object)
         if(self->idle_layout)
             g_source_remove(self->idle_layout);
 
+        cancel_motion(self);
+
         g_signal_handlers_disconnect_by_func(self->dnd_src, on_dnd_src_data_get, self);
         g_object_unref(self->dnd_src);
         g_object_unref(self->dnd_dest);
     }
 
+    /* the accessible may be held by ATK bridge longer than we live */
+    if (self->accessible)
+    {
+        g_object_remove_weak_pointer(G_OBJECT(self->accessible),
+                                     (gpointer *)&self->accessible);
+        self->accessible = NULL;
+    }
+
     if (self->conf.configured)
     {
         self->conf.configured = FALSE;
         if (self->conf.changed) /* if config was changed then save it now */
-            save_item_pos(self);
+            save_config(self);
         g_free(self->conf.wallpaper);
         if (self->conf.wallpapers_configured > 0)
         {
@@ -4882,6 +6718,7 @@ static void fm_desktop_destroy(GtkObject *object)
         g_free(self->conf.folder);
     }
 
+    _bg_job_cancel(self);
     _clear_bg_cache(self);
 
     /* cancel any pending search timeout */
@@ -4898,6 +6735,11 @@ static void fm_desktop_destroy(GtkObject *object)
         g_signal_handlers_disconnect_by_func(self->search_window, desktop_search_scroll_event, self);
         g_signal_handlers_disconnect_by_func(self->search_window, desktop_search_key_press_event, self);
         gtk_widget_destroy(self->search_window);
+        if (self->search_matches)
+            g_ptr_array_free(self->search_matches, TRUE);
+        self->search_matches = NULL;
+        g_free(self->search_prefix);
+        self->search_prefix = NULL;
         self->search_entry = NULL;
         self->search_window = NULL;
     }
@@ -4946,6 +6788,7 @@ static GObject* fm_desktop_constructor(GType type, guint n_construct_properties,
     gtk_window_set_default_size((GtkWindow*)self, geom.width, geom.height);
     gtk_window_move(GTK_WINDOW(self), geom.x, geom.y);
     gtk_widget_set_app_paintable((GtkWidget*)self, TRUE);
+    gtk_widget_set_has_tooltip((GtkWidget*)self, TRUE);
     gtk_window_set_type_hint(GTK_WINDOW(self), GDK_WINDOW_TYPE_HINT_DESKTOP);
     gtk_widget_add_events((GtkWidget*)self,
                         GDK_POINTER_MOTION_MASK |
@@ -5062,6 +6905,7 @@ static void fm_desktop_class_init(FmDesktopClass *klass)
     widget_class->button_release_event = on_button_release;
     widget_class->motion_notify_event = on_motion_notify;
     widget_class->leave_notify_event = on_leave_notify;
+    widget_class->query_tooltip = on_query_tooltip;
     widget_class->key_press_event = on_key_press;
     /* widget_class->style_set = on_style_set; */
     widget_class->direction_changed = on_direction_changed;
@@ -5179,24 +7023,7 @@ static FmFolderModel* _get_model(FmFolderView* fv)
 
 static gint _count_selected_files(FmFolderView* fv)
 {
-    FmDesktop* desktop = FM_DESKTOP(fv);
-    GtkTreeModel* model;
-    GtkTreeIter it;
-    gint n = 0;
-
-    if (!desktop->model)
-        return 0;
-    model = GTK_TREE_MODEL(desktop->model);
-    if(!gtk_tree_model_get_iter_first(model, &it))
-        return 0;
-    do
-    {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(desktop->model, &it);
-        if(item->is_selected)
-            n++;
-    }
-    while(gtk_tree_model_iter_next(model, &it));
-    return n;
+    return FM_DESKTOP(fv)->selected.length;
 }
 
 static FmFileInfoList* _dup_selected_files(FmFolderView* fv)
@@ -5267,7 +7094,7 @@ static void _select_all(FmFolderView* fv)
         FmDesktopItem* item = fm_folder_model_get_item_userdata(desktop->model, &it);
         if(!item->is_selected)
         {
-            item->is_selected = TRUE;
+            set_item_selected(desktop, item, TRUE);
             redraw_item(desktop, item);
             fm_desktop_item_selected_changed(desktop, item);
         }
@@ -5278,25 +7105,15 @@ static void _select_all(FmFolderView* fv)
 static void _unselect_all(FmFolderView* fv)
 {
     FmDesktop* desktop = FM_DESKTOP(fv);
-    GtkTreeIter it;
-    GtkTreeModel* model;
+    FmDesktopItem* item;
 
-    if (!desktop->model)
-        return;
-    model = GTK_TREE_MODEL(desktop->model);
-    if(!gtk_tree_model_get_iter_first(model, &it))
-        return;
-    do
+    /* only selected items are visited */
+    while ((item = g_queue_peek_head(&desktop->selected)) != NULL)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(desktop->model, &it);
-        if(item->is_selected)
-        {
-            item->is_selected = FALSE;
-            redraw_item(desktop, item);
-            fm_desktop_item_selected_changed(desktop, item);
-        }
+        set_item_selected(desktop, item, FALSE);
+        redraw_item(desktop, item);
+        fm_desktop_item_selected_changed(desktop, item);
     }
-    while(gtk_tree_model_iter_next(model, &it));
 }
 
 static void _select_invert(FmFolderView* fv)
@@ -5497,6 +7314,7 @@ static void on_desktop_font_set(GtkFontButton* btn, FmDesktop *desktop)
 
             pango_context_set_font_description(pc, font_desc);
             pango_layout_context_changed(desktop->pl);
+            desktop->text_serial++; /* labels should be shaped again */
             gtk_widget_queue_resize(GTK_WIDGET(desktop));
             pango_font_description_free(font_desc);
         }
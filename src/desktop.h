@@ -45,6 +45,8 @@ typedef struct _FmDesktop           FmDesktop;
 typedef struct _FmDesktopClass      FmDesktopClass;
 typedef struct _FmDesktopItem       FmDesktopItem;
 typedef struct _FmBackgroundCache   FmBackgroundCache;
+typedef struct _FmBackgroundJob     FmBackgroundJob;
+typedef struct _FmDesktopGrid       FmDesktopGrid;
 
 struct _FmDesktop
 {
@@ -64,19 +66,33 @@ struct _FmDesktop
     guint pango_text_w;
     guint cell_w;
     guint cell_h;
+    guint text_serial; /* changed when item labels should be shaped again */
     GdkRectangle working_area;
     FmDesktopItem* focus;
     FmDesktopItem* drop_hilight;
     FmDesktopItem* hover_item;
     gint rubber_bending_x;
     gint rubber_bending_y;
+    gint motion_pending_x; /* last pointer position not applied yet */
+    gint motion_pending_y;
+    guint idle_motion; /* idle source or tick callback to apply motion */
+    guint motion_received; /* statistics: motion events received ... */
+    guint motion_processed; /* ... and applied, others were dropped */
     gint drag_start_x;
     gint drag_start_y;
     gboolean rubber_bending : 1;
     gboolean forward_pending : 1;
     gboolean dragging : 1;
     gboolean layout_pending : 1;
+    gboolean layout_done : 1; /* items were laid out since model was set */
+    gboolean layout_partial : 1; /* queued layout is incremental */
+    gboolean sel_area_valid : 1; /* sel_area is up to date */
+    gboolean nav_valid : 1; /* nav_by_x and nav_by_y are up to date */
+    gboolean search_matches_valid : 1; /* search_matches may be narrowed */
+    gboolean pos_changed : 1; /* fixed items were moved since last save */
     guint idle_layout;
+    guint relayout_from; /* range of rows changed since last layout */
+    guint relayout_to;
     FmDndSrc* dnd_src;
     FmDndDest* dnd_dest;
     guint single_click_timeout_handler;
@@ -84,16 +100,32 @@ struct _FmDesktop
     FmFolderModel* model;
     guint cur_desktop;
     gint monitor;
-    FmBackgroundCache *cache;
+    GSList *cache; /* referenced FmBackgroundCache images */
+    FmBackgroundJob *bg_job; /* wallpaper being loaded */
+    FmDesktopGrid *grid; /* spatial index of items */
+    GQueue label_cache; /* items with rendered label, recently painted first */
+    gsize label_cache_size; /* memory used by rendered labels, in bytes */
+    gint label_scale; /* window scale factor of rendered labels */
+    GQueue selected; /* selected items, in order of selection */
+    GdkRectangle sel_area; /* bounding box of icons of selected items */
+    FmDesktopItem** nav_by_x; /* items sorted by columns, for keyboard navigation */
+    FmDesktopItem** nav_by_y; /* items sorted by rows */
+    guint nav_len;
+    GHashTable *positions; /* file name -> saved position of fixed item */
+    guint pos_records; /* records in the positions file */
+    guint pos_stamp; /* counter of save_item_pos() calls */
 #if GTK_CHECK_VERSION(3, 0, 0)
     GtkCssProvider *css;
 #endif
+    AtkObject *accessible; /* set only after ATK asked for it */
     /* interactive search subwindow */
     GtkWidget *search_window;
     GtkWidget *search_entry;
     gboolean search_imcontext_changed : 1;
     guint search_entry_changed_id;
     guint search_timeout_id;
+    GPtrArray *search_matches; /* items matching search_prefix, in model order */
+    char *search_prefix; /* normalized search text */
     /* desktop settings for this monitor */
     FmDesktopConfig conf;
 };
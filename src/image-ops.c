@@ -0,0 +1,865 @@
+/*
+ *      image-ops.c: fast operations on image data
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "image-ops.h"
+#include "pcmanfm.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define HAVE_SSE2 1
+#endif
+
+/* AVX2 code is compiled with target attribute and selected at runtime */
+#if defined(HAVE_SSE2) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && \
+     (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+# include <immintrin.h>
+# define HAVE_AVX2 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define HAVE_NEON 1
+#endif
+
+/* all code paths use the same fixed point arithmetic so they give exactly
+   the same result: 8 bit samples multiplied by coefficients with 14 bits
+   of fraction fit 16 bit operands of pmaddwd and sum up in 32 bits */
+#define COEF_BITS 14
+#define COEF_HALF (1 << (COEF_BITS - 1))
+
+/* rows of pixels which are filtered by one thread at once */
+#define ROWS_PER_TASK 32
+
+typedef double (*ImageOpsFilter)(double x);
+
+typedef struct
+{
+    int *bounds; /* for each output sample: first input sample and count */
+    gint16 *coefs; /* for each output sample: ksize coefficients */
+    int ksize;
+} ScaleCoefs;
+
+typedef void (*ScaleFunc)(const guint8 *src, int src_stride, guint8 *dest,
+                          int dest_stride, int n_channels, int width,
+                          const ScaleCoefs *coefs, int from, int to);
+
+typedef struct
+{
+    const guint8 *src;
+    int src_stride;
+    guint8 *dest;
+    int dest_stride;
+    int n_channels;
+    int width; /* width of dest, in pixels */
+    const ScaleCoefs *coefs;
+    ScaleFunc func;
+} ScalePass;
+
+typedef struct
+{
+    const ScalePass *pass;
+    int from, to; /* rows of dest */
+    GAsyncQueue *done;
+} ScaleTask;
+
+static double filter_box(double x)
+{
+    return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+}
+
+static double filter_triangle(double x)
+{
+    x = fabs(x);
+    return (x < 1.0) ? 1.0 - x : 0.0;
+}
+
+static inline double sinc(double x)
+{
+    if(x == 0.0)
+        return 1.0;
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static double filter_lanczos(double x)
+{
+    /* Lanczos with a = 3 */
+    if(x > -3.0 && x < 3.0)
+        return sinc(x) * sinc(x / 3.0);
+    return 0.0;
+}
+
+/* computes contribution of input samples into each output sample */
+static void scale_coefs_init(ScaleCoefs *sc, int in_size, int out_size,
+                             ImageOpsFilter filter, double support)
+{
+    double scale = (double)in_size / out_size;
+    double filterscale = MAX(scale, 1.0);
+    double *k, ww, center;
+    int xx, x, xmin, xmax, v;
+
+    support *= filterscale;
+    sc->ksize = (int)ceil(support) * 2 + 1;
+    sc->bounds = g_new(int, out_size * 2);
+    sc->coefs = g_new0(gint16, out_size * sc->ksize);
+    k = g_new(double, sc->ksize);
+    for(xx = 0; xx < out_size; xx++)
+    {
+        center = (xx + 0.5) * scale;
+        xmin = (int)(center - support + 0.5);
+        if(xmin < 0)
+            xmin = 0;
+        xmax = (int)(center + support + 0.5);
+        if(xmax > in_size)
+            xmax = in_size;
+        xmax -= xmin;
+        if(xmax > sc->ksize)
+            xmax = sc->ksize;
+        ww = 0.0;
+        for(x = 0; x < xmax; x++)
+        {
+            k[x] = filter((x + xmin - center + 0.5) / filterscale);
+            ww += k[x];
+        }
+        for(x = 0; x < xmax; x++)
+        {
+            v = (int)lrint((ww != 0.0 ? k[x] / ww : 0.0) * (1 << COEF_BITS));
+            sc->coefs[xx * sc->ksize + x] = CLAMP(v, G_MININT16, G_MAXINT16);
+        }
+        sc->bounds[xx * 2] = xmin;
+        sc->bounds[xx * 2 + 1] = xmax;
+    }
+    g_free(k);
+}
+
+static void scale_coefs_clear(ScaleCoefs *sc)
+{
+    g_free(sc->bounds);
+    g_free(sc->coefs);
+}
+
+static inline guint8 clip8(int ss)
+{
+    ss >>= COEF_BITS;
+    return (guint8)CLAMP(ss, 0, 255);
+}
+
+/* horizontal pass: rows from..to of dest are made from the same rows of src */
+static void scale_horiz_scalar(const guint8 *src, int src_stride, guint8 *dest,
+                               int dest_stride, int n_channels, int width,
+                               const ScaleCoefs *sc, int from, int to)
+{
+    int yy, xx, x, c, n, ss;
+    const guint8 *in;
+    const gint16 *k;
+    guint8 *out;
+
+    for(yy = from; yy < to; yy++)
+    {
+        out = dest + (gsize)yy * dest_stride;
+        for(xx = 0; xx < width; xx++)
+        {
+            in = src + (gsize)yy * src_stride + sc->bounds[xx * 2] * n_channels;
+            n = sc->bounds[xx * 2 + 1];
+            k = &sc->coefs[xx * sc->ksize];
+            for(c = 0; c < n_channels; c++)
+            {
+                ss = COEF_HALF;
+                for(x = 0; x < n; x++)
+                    ss += in[x * n_channels + c] * k[x];
+                *out++ = clip8(ss);
+            }
+        }
+    }
+}
+
+/* vertical pass: each sample of dest row is made from the same column */
+static void scale_vert_scalar(const guint8 *src, int src_stride, guint8 *dest,
+                              int dest_stride, int n_channels, int width,
+                              const ScaleCoefs *sc, int from, int to)
+{
+    int yy, i, y, n, ss, len = width * n_channels;
+    const guint8 *in;
+    const gint16 *k;
+    guint8 *out;
+
+    for(yy = from; yy < to; yy++)
+    {
+        in = src + (gsize)sc->bounds[yy * 2] * src_stride;
+        n = sc->bounds[yy * 2 + 1];
+        k = &sc->coefs[yy * sc->ksize];
+        out = dest + (gsize)yy * dest_stride;
+        for(i = 0; i < len; i++)
+        {
+            ss = COEF_HALF;
+            for(y = 0; y < n; y++)
+                ss += in[(gsize)y * src_stride + i] * k[y];
+            out[i] = clip8(ss);
+        }
+    }
+}
+
+#ifdef HAVE_SSE2
+/* two coefficients for pmaddwd */
+static inline guint32 coef_pair(gint16 k0, gint16 k1)
+{
+    return ((guint32)(guint16)k1 << 16) | (guint16)k0;
+}
+
+static inline __m128i load_px(const guint8 *p, int n_channels)
+{
+    guint32 v;
+
+    if(n_channels == 4)
+        memcpy(&v, p, 4);
+    else /* 3 channels, don't read past the end of row */
+        v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return _mm_cvtsi32_si128(v);
+}
+
+static void scale_horiz_sse2(const guint8 *src, int src_stride, guint8 *dest,
+                             int dest_stride, int n_channels, int width,
+                             const ScaleCoefs *sc, int from, int to)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int yy, xx, x, n;
+    const guint8 *in;
+    const gint16 *k;
+    guint8 *out;
+    __m128i sss, p0, p1, mmk;
+    guint32 v;
+
+    if(n_channels != 3 && n_channels != 4)
+    {
+        scale_horiz_scalar(src, src_stride, dest, dest_stride, n_channels,
+                           width, sc, from, to);
+        return;
+    }
+    for(yy = from; yy < to; yy++)
+    {
+        out = dest + (gsize)yy * dest_stride;
+        for(xx = 0; xx < width; xx++)
+        {
+            in = src + (gsize)yy * src_stride + sc->bounds[xx * 2] * n_channels;
+            n = sc->bounds[xx * 2 + 1];
+            k = &sc->coefs[xx * sc->ksize];
+            sss = _mm_set1_epi32(COEF_HALF);
+            for(x = 0; x + 1 < n; x += 2)
+            {
+                /* interleave channels of two pixels: r0 r1 g0 g1 ... */
+                p0 = _mm_unpacklo_epi8(load_px(in + x * n_channels, n_channels), zero);
+                p1 = _mm_unpacklo_epi8(load_px(in + (x + 1) * n_channels, n_channels), zero);
+                mmk = _mm_set1_epi32(coef_pair(k[x], k[x + 1]));
+                sss = _mm_add_epi32(sss, _mm_madd_epi16(_mm_unpacklo_epi16(p0, p1), mmk));
+            }
+            if(x < n)
+            {
+                p0 = _mm_unpacklo_epi8(load_px(in + x * n_channels, n_channels), zero);
+                mmk = _mm_set1_epi32(coef_pair(k[x], 0));
+                sss = _mm_add_epi32(sss, _mm_madd_epi16(_mm_unpacklo_epi16(p0, zero), mmk));
+            }
+            sss = _mm_srai_epi32(sss, COEF_BITS);
+            sss = _mm_packs_epi32(sss, sss);
+            v = _mm_cvtsi128_si32(_mm_packus_epi16(sss, sss));
+            if(n_channels == 4)
+                memcpy(out, &v, 4);
+            else
+            {
+                out[0] = v;
+                out[1] = v >> 8;
+                out[2] = v >> 16;
+            }
+            out += n_channels;
+        }
+    }
+}
+
+static void scale_vert_sse2(const guint8 *src, int src_stride, guint8 *dest,
+                            int dest_stride, int n_channels, int width,
+                            const ScaleCoefs *sc, int from, int to)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int yy, i, y, n, ss, len = width * n_channels;
+    const guint8 *in;
+    const gint16 *k;
+    guint8 *out;
+    __m128i sss0, sss1, a, b, mmk;
+
+    for(yy = from; yy < to; yy++)
+    {
+        in = src + (gsize)sc->bounds[yy * 2] * src_stride;
+        n = sc->bounds[yy * 2 + 1];
+        k = &sc->coefs[yy * sc->ksize];
+        out = dest + (gsize)yy * dest_stride;
+        for(i = 0; i + 8 <= len; i += 8)
+        {
+            sss0 = sss1 = _mm_set1_epi32(COEF_HALF);
+            for(y = 0; y + 1 < n; y += 2)
+            {
+                a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(in + (gsize)y * src_stride + i)), zero);
+                b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(in + (gsize)(y + 1) * src_stride + i)), zero);
+                mmk = _mm_set1_epi32(coef_pair(k[y], k[y + 1]));
+                sss0 = _mm_add_epi32(sss0, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), mmk));
+                sss1 = _mm_add_epi32(sss1, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), mmk));
+            }
+            if(y < n)
+            {
+                a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(in + (gsize)y * src_stride + i)), zero);
+                mmk = _mm_set1_epi32(coef_pair(k[y], 0));
+                sss0 = _mm_add_epi32(sss0, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), mmk));
+                sss1 = _mm_add_epi32(sss1, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), mmk));
+            }
+            sss0 = _mm_packs_epi32(_mm_srai_epi32(sss0, COEF_BITS),
+                                   _mm_srai_epi32(sss1, COEF_BITS));
+            _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(sss0, sss0));
+        }
+        for(; i < len; i++)
+        {
+            ss = COEF_HALF;
+            for(y = 0; y < n; y++)
+                ss += in[(gsize)y * src_stride + i] * k[y];
+            out[i] = clip8(ss);
+        }
+    }
+}
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+static void scale_vert_avx2(const guint8 *src, int src_stride, guint8 *dest,
+                            int dest_stride, int n_channels, int width,
+                            const ScaleCoefs *sc, int from, int to)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    int yy, i, y, n, ss, len = width * n_channels;
+    const guint8 *in;
+    const gint16 *k;
+    guint8 *out;
+    __m256i sss0, sss1, a, b, mmk;
+
+    for(yy = from; yy < to; yy++)
+    {
+        in = src + (gsize)sc->bounds[yy * 2] * src_stride;
+        n = sc->bounds[yy * 2 + 1];
+        k = &sc->coefs[yy * sc->ksize];
+        out = dest + (gsize)yy * dest_stride;
+        for(i = 0; i + 16 <= len; i += 16)
+        {
+            sss0 = sss1 = _mm256_set1_epi32(COEF_HALF);
+            for(y = 0; y + 1 < n; y += 2)
+            {
+                a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(in + (gsize)y * src_stride + i)));
+                b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(in + (gsize)(y + 1) * src_stride + i)));
+                mmk = _mm256_set1_epi32(coef_pair(k[y], k[y + 1]));
+                sss0 = _mm256_add_epi32(sss0, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), mmk));
+                sss1 = _mm256_add_epi32(sss1, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), mmk));
+            }
+            if(y < n)
+            {
+                a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(in + (gsize)y * src_stride + i)));
+                mmk = _mm256_set1_epi32(coef_pair(k[y], 0));
+                sss0 = _mm256_add_epi32(sss0, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, zero), mmk));
+                sss1 = _mm256_add_epi32(sss1, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, zero), mmk));
+            }
+            /* unpack works within 128 bit lanes so packs restores order */
+            sss0 = _mm256_packs_epi32(_mm256_srai_epi32(sss0, COEF_BITS),
+                                      _mm256_srai_epi32(sss1, COEF_BITS));
+            sss0 = _mm256_permute4x64_epi64(_mm256_packus_epi16(sss0, sss0), 0xd8);
+            _mm_storeu_si128((__m128i*)(out + i), _mm256_castsi256_si128(sss0));
+        }
+        for(; i < len; i++)
+        {
+            ss = COEF_HALF;
+            for(y = 0; y < n; y++)
+                ss += in[(gsize)y * src_stride + i] * k[y];
+            out[i] = clip8(ss);
+        }
+    }
+}
+#endif /* HAVE_AVX2 */
+
+/* reciprocals for the alpha: unpremultiplied value of sample c is
+   (c * 255 + a / 2) / a which is equal to ((c * 255 + a / 2) + 0.5) / a
+   rounded down; since the latter is never closer to an integer than 1/510
+   the single precision float product with the reciprocal is exact */
+static float unpremul_rcp[256];
+static float unpremul_bias[256];
+
+static void unpremultiply_init(void)
+{
+    static gsize inited = 0;
+    int a;
+
+    if(g_once_init_enter(&inited))
+    {
+        unpremul_rcp[0] = 0.0f; /* transparent pixel gets zeros */
+        unpremul_bias[0] = 0.0f;
+        for(a = 1; a < 256; a++)
+        {
+            unpremul_rcp[a] = 1.0f / a;
+            unpremul_bias[a] = (a / 2) + 0.5f;
+        }
+        g_once_init_leave(&inited, 1);
+    }
+}
+
+static inline guint8 unpremultiply_sample(guint c, guint a)
+{
+    guint v = (guint)((c * 255.0f + unpremul_bias[a]) * unpremul_rcp[a]);
+
+    return MIN(v, 255);
+}
+
+/* alpha weighting of the filters: colors are premultiplied before the
+   first pass and unpremultiplied after the last one so colors of
+   transparent pixels don't bleed into edges of opaque areas */
+static void scale_premultiply(const guint8 *src, int src_stride, guint8 *dest,
+                              int dest_stride, int n_channels, int width,
+                              const ScaleCoefs *sc, int from, int to)
+{
+    const guint8 *in;
+    guint8 *out;
+    guint t;
+    int yy, x, c;
+
+    for(yy = from; yy < to; yy++)
+    {
+        in = src + (gsize)yy * src_stride;
+        out = dest + (gsize)yy * dest_stride;
+        for(x = 0; x < width; x++, in += 4, out += 4)
+        {
+            for(c = 0; c < 3; c++)
+            {
+                /* rounded division by 255 */
+                t = in[c] * in[3] + 128;
+                out[c] = (t + (t >> 8)) >> 8;
+            }
+            out[3] = in[3];
+        }
+    }
+}
+
+/* works in place, src and dest are the same */
+static void scale_unpremultiply(const guint8 *src, int src_stride, guint8 *dest,
+                                int dest_stride, int n_channels, int width,
+                                const ScaleCoefs *sc, int from, int to)
+{
+    guint8 *out;
+    int yy, x;
+
+    for(yy = from; yy < to; yy++)
+    {
+        out = dest + (gsize)yy * dest_stride;
+        for(x = 0; x < width; x++, out += 4)
+        {
+            out[0] = unpremultiply_sample(out[0], out[3]);
+            out[1] = unpremultiply_sample(out[1], out[3]);
+            out[2] = unpremultiply_sample(out[2], out[3]);
+        }
+    }
+}
+
+static gboolean has_translucent_pixels(GdkPixbuf *pix)
+{
+    const guint8 *row = gdk_pixbuf_get_pixels(pix);
+    int width = gdk_pixbuf_get_width(pix);
+    int height = gdk_pixbuf_get_height(pix);
+    int stride = gdk_pixbuf_get_rowstride(pix);
+    int x, y;
+
+    for(y = 0; y < height; y++, row += stride)
+        for(x = 0; x < width; x++)
+            if(row[x * 4 + 3] != 255)
+                return TRUE;
+    return FALSE;
+}
+
+static GThreadPool *scale_pool = NULL;
+static int scale_threads = 1;
+
+static void scale_task_run(gpointer data, gpointer unused)
+{
+    ScaleTask *task = data;
+    const ScalePass *pass = task->pass;
+
+    pass->func(pass->src, pass->src_stride, pass->dest, pass->dest_stride,
+               pass->n_channels, pass->width, pass->coefs, task->from, task->to);
+    if(task->done)
+        g_async_queue_push(task->done, task);
+}
+
+static void scale_init(void)
+{
+    static gsize inited = 0;
+
+    if(g_once_init_enter(&inited))
+    {
+        scale_threads = pcmanfm_get_num_processors();
+        if(scale_threads > 1)
+            scale_pool = g_thread_pool_new(scale_task_run, NULL,
+                                           scale_threads - 1, FALSE, NULL);
+        if(scale_pool == NULL)
+            scale_threads = 1;
+        g_once_init_leave(&inited, 1);
+    }
+}
+
+/* runs the pass splitting rows between threads */
+static void scale_pass_run(const ScalePass *pass, int rows)
+{
+    ScaleTask *tasks, *task;
+    GAsyncQueue *done;
+    int n, i, chunk;
+
+    n = MIN(scale_threads, (rows + ROWS_PER_TASK - 1) / ROWS_PER_TASK);
+    if(n <= 1)
+    {
+        pass->func(pass->src, pass->src_stride, pass->dest, pass->dest_stride,
+                   pass->n_channels, pass->width, pass->coefs, 0, rows);
+        return;
+    }
+    tasks = g_new(ScaleTask, n);
+    done = g_async_queue_new();
+    chunk = (rows + n - 1) / n;
+    for(i = 0; i < n; i++)
+    {
+        tasks[i].pass = pass;
+        tasks[i].from = i * chunk;
+        tasks[i].to = MIN(rows, (i + 1) * chunk);
+        tasks[i].done = done;
+        /* the last chunk is done by this thread */
+        if(i < n - 1)
+            g_thread_pool_push(scale_pool, &tasks[i], NULL);
+    }
+    tasks[n - 1].done = NULL;
+    scale_task_run(&tasks[n - 1], NULL);
+    for(i = 0; i < n - 1; i++)
+    {
+        task = g_async_queue_pop(done);
+        (void)task;
+    }
+    g_async_queue_unref(done);
+    g_free(tasks);
+}
+
+static ScaleFunc scale_get_horiz(void)
+{
+#ifdef HAVE_SSE2
+    return scale_horiz_sse2;
+#else
+    return scale_horiz_scalar;
+#endif
+}
+
+static ScaleFunc scale_get_vert(void)
+{
+#ifdef HAVE_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return scale_vert_avx2;
+#endif
+#ifdef HAVE_SSE2
+    return scale_vert_sse2;
+#else
+    return scale_vert_scalar;
+#endif
+}
+
+/**
+ * image_ops_scale
+ * @src: source image
+ * @dest_w: width of result
+ * @dest_h: height of result
+ * @mode: filter to use
+ *
+ * Scales @src to new size like gdk_pixbuf_scale_simple() does but uses
+ * separable filter with SIMD instructions and splits work between all
+ * available processors. Only 8 bit RGB and RGBA images are supported,
+ * other ones are handled by gdk_pixbuf_scale_simple(). Like that one, it
+ * weights colors of RGBA images by alpha.
+ *
+ * This function is thread-safe.
+ *
+ * Returns: (transfer full): new image or %NULL if no memory.
+ */
+GdkPixbuf *image_ops_scale(GdkPixbuf *src, int dest_w, int dest_h,
+                           ImageOpsScaleMode mode)
+{
+    int src_w = gdk_pixbuf_get_width(src);
+    int src_h = gdk_pixbuf_get_height(src);
+    int n_channels = gdk_pixbuf_get_n_channels(src);
+    ImageOpsFilter filter_x, filter_y;
+    double support_x, support_y;
+    ScaleCoefs coefs_x, coefs_y;
+    ScalePass pass;
+    GdkPixbuf *dest, *tmp = NULL, *pre = NULL;
+#ifdef G_ENABLE_DEBUG
+    GTimer *timer = g_timer_new();
+#endif
+
+    if(mode == IMAGE_OPS_SCALE_COMPAT || dest_w <= 0 || dest_h <= 0
+       || gdk_pixbuf_get_colorspace(src) != GDK_COLORSPACE_RGB
+       || gdk_pixbuf_get_bits_per_sample(src) != 8
+       || (n_channels != 3 && n_channels != 4))
+        return gdk_pixbuf_scale_simple(src, dest_w, dest_h, GDK_INTERP_BILINEAR);
+    if(src_w == dest_w && src_h == dest_h)
+        return gdk_pixbuf_copy(src);
+    scale_init();
+    dest = gdk_pixbuf_new(GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha(src),
+                          8, dest_w, dest_h);
+    if(dest == NULL)
+        return NULL;
+
+    if(mode == IMAGE_OPS_SCALE_BEST)
+    {
+        filter_x = filter_y = filter_lanczos;
+        support_x = support_y = 3.0;
+    }
+    else /* IMAGE_OPS_SCALE_FAST */
+    {
+        filter_x = (dest_w < src_w) ? filter_box : filter_triangle;
+        support_x = (dest_w < src_w) ? 0.5 : 1.0;
+        filter_y = (dest_h < src_h) ? filter_box : filter_triangle;
+        support_y = (dest_h < src_h) ? 0.5 : 1.0;
+    }
+
+    pass.src = gdk_pixbuf_get_pixels(src);
+    pass.src_stride = gdk_pixbuf_get_rowstride(src);
+    pass.n_channels = n_channels;
+    if(n_channels == 4 && has_translucent_pixels(src))
+    {
+        /* filter premultiplied copy of src */
+        pre = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, src_w, src_h);
+        if(pre == NULL)
+        {
+            g_object_unref(dest);
+            return NULL;
+        }
+        unpremultiply_init();
+        pass.dest = gdk_pixbuf_get_pixels(pre);
+        pass.dest_stride = gdk_pixbuf_get_rowstride(pre);
+        pass.width = src_w;
+        pass.coefs = NULL;
+        pass.func = scale_premultiply;
+        scale_pass_run(&pass, src_h);
+        pass.src = pass.dest;
+        pass.src_stride = pass.dest_stride;
+    }
+    if(src_w != dest_w)
+    {
+        /* if height is changed too then filter into intermediate image */
+        if(src_h != dest_h)
+        {
+            tmp = gdk_pixbuf_new(GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha(src),
+                                 8, dest_w, src_h);
+            if(tmp == NULL)
+            {
+                if(pre)
+                    g_object_unref(pre);
+                g_object_unref(dest);
+                return NULL;
+            }
+        }
+        scale_coefs_init(&coefs_x, src_w, dest_w, filter_x, support_x);
+        pass.dest = gdk_pixbuf_get_pixels(tmp ? tmp : dest);
+        pass.dest_stride = gdk_pixbuf_get_rowstride(tmp ? tmp : dest);
+        pass.width = dest_w;
+        pass.coefs = &coefs_x;
+        pass.func = scale_get_horiz();
+        scale_pass_run(&pass, src_h);
+        scale_coefs_clear(&coefs_x);
+        pass.src = pass.dest;
+        pass.src_stride = pass.dest_stride;
+    }
+    if(src_h != dest_h)
+    {
+        scale_coefs_init(&coefs_y, src_h, dest_h, filter_y, support_y);
+        pass.dest = gdk_pixbuf_get_pixels(dest);
+        pass.dest_stride = gdk_pixbuf_get_rowstride(dest);
+        pass.width = dest_w;
+        pass.coefs = &coefs_y;
+        pass.func = scale_get_vert();
+        scale_pass_run(&pass, dest_h);
+        scale_coefs_clear(&coefs_y);
+    }
+    if(pre)
+    {
+        pass.src = pass.dest = gdk_pixbuf_get_pixels(dest);
+        pass.src_stride = pass.dest_stride = gdk_pixbuf_get_rowstride(dest);
+        pass.width = dest_w;
+        pass.func = scale_unpremultiply;
+        scale_pass_run(&pass, dest_h);
+        g_object_unref(pre);
+    }
+    if(tmp)
+        g_object_unref(tmp);
+#ifdef G_ENABLE_DEBUG
+    g_debug("image_ops_scale: %dx%d -> %dx%d mode %d in %d threads: %.3f s",
+            src_w, src_h, dest_w, dest_h, (int)mode, scale_threads,
+            g_timer_elapsed(timer, NULL));
+    g_timer_destroy(timer);
+#endif
+    return dest;
+}
+
+static void unpremultiply_row_scalar(const guint32 *src, guint8 *dest, int width)
+{
+    int x;
+    guint a;
+
+    for(x = 0; x < width; x++)
+    {
+        a = src[x] >> 24;
+        dest[x * 4 + 0] = unpremultiply_sample((src[x] >> 16) & 0xff, a);
+        dest[x * 4 + 1] = unpremultiply_sample((src[x] >> 8) & 0xff, a);
+        dest[x * 4 + 2] = unpremultiply_sample(src[x] & 0xff, a);
+        dest[x * 4 + 3] = a;
+    }
+}
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#ifdef HAVE_SSE2
+/* pixel of cairo is B G R A in memory on little endian */
+static inline __m128i unpremultiply_px_sse2(__m128i px, guint a)
+{
+    __m128 v = _mm_cvtepi32_ps(px);
+
+    v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_set1_ps(unpremul_bias[a]));
+    return _mm_cvttps_epi32(_mm_mul_ps(v, _mm_set1_ps(unpremul_rcp[a])));
+}
+
+static void unpremultiply_row_sse2(const guint32 *src, guint8 *dest, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i amask = _mm_set1_epi32(0xff000000);
+    __m128i px, lo, hi, p0, p1, p2, p3;
+    int x;
+
+    for(x = 0; x + 4 <= width; x += 4)
+    {
+        px = _mm_loadu_si128((const __m128i*)(src + x));
+        lo = _mm_unpacklo_epi8(px, zero);
+        hi = _mm_unpackhi_epi8(px, zero);
+        p0 = unpremultiply_px_sse2(_mm_unpacklo_epi16(lo, zero), src[x] >> 24);
+        p1 = unpremultiply_px_sse2(_mm_unpackhi_epi16(lo, zero), src[x + 1] >> 24);
+        p2 = unpremultiply_px_sse2(_mm_unpacklo_epi16(hi, zero), src[x + 2] >> 24);
+        p3 = unpremultiply_px_sse2(_mm_unpackhi_epi16(hi, zero), src[x + 3] >> 24);
+        /* B G R A -> R G B A */
+        lo = _mm_packs_epi32(p0, p1);
+        hi = _mm_packs_epi32(p2, p3);
+        lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 0, 1, 2)),
+                                 _MM_SHUFFLE(3, 0, 1, 2));
+        hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 0, 1, 2)),
+                                 _MM_SHUFFLE(3, 0, 1, 2));
+        lo = _mm_packus_epi16(lo, hi);
+        /* alpha is kept as is */
+        lo = _mm_or_si128(_mm_andnot_si128(amask, lo), _mm_and_si128(amask, px));
+        _mm_storeu_si128((__m128i*)(dest + x * 4), lo);
+    }
+    unpremultiply_row_scalar(src + x, dest + x * 4, width - x);
+}
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_NEON
+static inline uint8x8_t unpremultiply_neon(uint8x8_t c, float32x4_t bias_lo,
+                                           float32x4_t bias_hi,
+                                           float32x4_t rcp_lo, float32x4_t rcp_hi)
+{
+    uint16x8_t c16 = vmovl_u8(c);
+    float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(c16)));
+    float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(c16)));
+
+    lo = vmulq_f32(vmlaq_n_f32(bias_lo, lo, 255.0f), rcp_lo);
+    hi = vmulq_f32(vmlaq_n_f32(bias_hi, hi, 255.0f), rcp_hi);
+    return vqmovn_u16(vcombine_u16(vqmovn_u32(vcvtq_u32_f32(lo)),
+                                   vqmovn_u32(vcvtq_u32_f32(hi))));
+}
+
+static void unpremultiply_row_neon(const guint32 *src, guint8 *dest, int width)
+{
+    float rcp[8], bias[8];
+    uint8x8x4_t px, out;
+    float32x4_t rcp_lo, rcp_hi, bias_lo, bias_hi;
+    int x, i;
+
+    for(x = 0; x + 8 <= width; x += 8)
+    {
+        /* planes of B, G, R and A samples */
+        px = vld4_u8((const guint8*)(src + x));
+        for(i = 0; i < 8; i++)
+        {
+            rcp[i] = unpremul_rcp[src[x + i] >> 24];
+            bias[i] = unpremul_bias[src[x + i] >> 24];
+        }
+        rcp_lo = vld1q_f32(rcp);
+        rcp_hi = vld1q_f32(rcp + 4);
+        bias_lo = vld1q_f32(bias);
+        bias_hi = vld1q_f32(bias + 4);
+        out.val[0] = unpremultiply_neon(px.val[2], bias_lo, bias_hi, rcp_lo, rcp_hi);
+        out.val[1] = unpremultiply_neon(px.val[1], bias_lo, bias_hi, rcp_lo, rcp_hi);
+        out.val[2] = unpremultiply_neon(px.val[0], bias_lo, bias_hi, rcp_lo, rcp_hi);
+        out.val[3] = px.val[3];
+        vst4_u8(dest + x * 4, out);
+    }
+    unpremultiply_row_scalar(src + x, dest + x * 4, width - x);
+}
+#endif /* HAVE_NEON */
+#endif /* G_LITTLE_ENDIAN */
+
+/**
+ * image_ops_unpremultiply
+ * @src: pixels of cairo image surface in CAIRO_FORMAT_ARGB32
+ * @src_stride: rowstride of @src
+ * @dest: pixels of GdkPixbuf with alpha channel
+ * @dest_stride: rowstride of @dest
+ * @width: width of image
+ * @height: height of image
+ *
+ * Converts premultiplied native endian ARGB data of cairo into RGBA data
+ * with straight alpha, the same way gdk_pixbuf_get_from_surface() does.
+ *
+ * This function is thread-safe.
+ */
+void image_ops_unpremultiply(const guchar *src, int src_stride, guchar *dest,
+                             int dest_stride, int width, int height)
+{
+    int y;
+
+    unpremultiply_init();
+    for(y = 0; y < height; y++)
+    {
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN && defined(HAVE_SSE2)
+        unpremultiply_row_sse2((const guint32*)src, dest, width);
+#elif G_BYTE_ORDER == G_LITTLE_ENDIAN && defined(HAVE_NEON)
+        unpremultiply_row_neon((const guint32*)src, dest, width);
+#else
+        unpremultiply_row_scalar((const guint32*)src, dest, width);
+#endif
+        src += src_stride;
+        dest += dest_stride;
+    }
+}
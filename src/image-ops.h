@@ -0,0 +1,42 @@
+/*
+ *      image-ops.h: fast operations on image data
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __IMAGE_OPS_H__
+#define __IMAGE_OPS_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    IMAGE_OPS_SCALE_COMPAT, /* gdk_pixbuf_scale_simple() with bilinear filter */
+    IMAGE_OPS_SCALE_FAST, /* box filter to reduce, bilinear to enlarge */
+    IMAGE_OPS_SCALE_BEST /* Lanczos filter */
+} ImageOpsScaleMode;
+
+GdkPixbuf *image_ops_scale(GdkPixbuf *src, int dest_w, int dest_h,
+                           ImageOpsScaleMode mode);
+
+void image_ops_unpremultiply(const guchar *src, int src_stride, guchar *dest,
+                             int dest_stride, int width, int height);
+
+G_END_DECLS
+
+#endif /* __IMAGE_OPS_H__ */
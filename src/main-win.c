@@ -255,6 +255,14 @@ static void update_sort_menu(FmMainWin* win)
         return;
     if(!fm_folder_model_get_sort(fm_folder_view_get_model(fv), &by, &mode))
         return;
+#if FM_CHECK_VERSION(1, 2, 0)
+    /* sorting by filter match score isn't in the menu and isn't saved */
+    if (fm_tab_page_is_sorted_by_score(win->current_page))
+    {
+        by = win->current_page->sort_by;
+        mode = win->current_page->sort_type;
+    }
+#endif
     type = FM_SORT_IS_ASCENDING(mode) ? GTK_SORT_ASCENDING : GTK_SORT_DESCENDING;
     /* we don't handle extended modes in radio actions so do that here */
     if(mode != win->current_page->sort_type)
@@ -1305,6 +1313,19 @@ static void on_sort_by(GtkRadioAction* act, GtkRadioAction *cur, FmMainWin* win)
 #if FM_CHECK_VERSION(1, 0, 2)
     FmFolderModel *model = fm_folder_view_get_model(fv);
 
+#if FM_CHECK_VERSION(1, 2, 0)
+    if (fm_tab_page_is_sorted_by_score(win->current_page))
+    {
+        /* the menu is only synced with the page sorting */
+        if (win->in_update)
+            return;
+        /* sorting chosen by user replaces sorting by match score, the
+           menu will be updated once the new sorting is set below */
+        win->in_update = TRUE;
+        fm_tab_page_cancel_sort_by_score(win->current_page);
+        win->in_update = FALSE;
+    }
+#endif
     if (model)
         fm_folder_model_set_sort(model, val, FM_SORT_DEFAULT);
 #else
@@ -1360,6 +1381,16 @@ static void on_sort_type(GtkRadioAction* act, GtkRadioAction *cur, FmMainWin* wi
     FmFolderModel *model = fm_folder_view_get_model(fv);
     FmSortMode mode;
 
+#if FM_CHECK_VERSION(1, 2, 0)
+    if (fm_tab_page_is_sorted_by_score(win->current_page))
+    {
+        if (win->in_update)
+            return;
+        win->in_update = TRUE;
+        fm_tab_page_cancel_sort_by_score(win->current_page);
+        win->in_update = FALSE;
+    }
+#endif
     if (model)
     {
         fm_folder_model_get_sort(model, NULL, &mode);
@@ -2580,23 +2611,64 @@ static void on_reload(GtkAction* act, FmMainWin* win)
 }
 
 #if FM_CHECK_VERSION(1, 0, 2)
+static void on_filter_mode_changed(GtkComboBox *mode, GtkWidget *by_score)
+{
+    /* only fuzzy matches have score */
+    gtk_widget_set_sensitive(by_score, gtk_combo_box_get_active(mode) == NAME_FILTER_FUZZY);
+}
+
 static void on_filter(GtkAction* act, FmMainWin* win)
 {
     FmTabPage *page = win->current_page;
-    const char *old_filter = page->filter_pattern ? page->filter_pattern : "*";
-    char *new_filter;
-
-    new_filter = fm_get_user_input(GTK_WINDOW(win), _("Select filter"),
-                                   _("Choose a new shell pattern to show files:"),
-                                   old_filter);
-    if (!new_filter) /* cancelled */
-        return;
-    if (strcmp(new_filter, "*"))
-        fm_tab_page_set_filter_pattern(page, new_filter);
-    else
-        fm_tab_page_set_filter_pattern(page, NULL);
-    g_free(new_filter);
-    gtk_window_set_title(GTK_WINDOW(win), fm_tab_page_get_title(page));
+    GtkBuilder *builder = gtk_builder_new();
+    GtkDialog *dlg;
+    GtkEntry *entry;
+    GtkComboBox *mode;
+    GtkToggleButton *by_score;
+    GtkLabel *error_label;
+    GError *error = NULL;
+    const char *pattern;
+    NameFilterMode new_mode;
+
+    gtk_builder_add_from_file(builder, PACKAGE_UI_DIR "/filter.ui", NULL);
+    dlg = GTK_DIALOG(gtk_builder_get_object(builder, "dlg"));
+    entry = GTK_ENTRY(gtk_builder_get_object(builder, "pattern"));
+    mode = GTK_COMBO_BOX(gtk_builder_get_object(builder, "mode"));
+    by_score = GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder, "by_score"));
+    error_label = GTK_LABEL(gtk_builder_get_object(builder, "error"));
+    g_object_unref(builder);
+
+    gtk_window_set_transient_for(GTK_WINDOW(dlg), GTK_WINDOW(win));
+    gtk_entry_set_text(entry, page->filter_pattern ? page->filter_pattern : "*");
+    g_signal_connect(mode, "changed", G_CALLBACK(on_filter_mode_changed), by_score);
+    gtk_combo_box_set_active(mode, page->filter ? page->filter_mode : NAME_FILTER_SHELL);
+    on_filter_mode_changed(mode, GTK_WIDGET(by_score));
+    gtk_toggle_button_set_active(by_score, page->filter_by_score);
+#if !FM_CHECK_VERSION(1, 2, 0)
+    /* libfm cannot sort by custom column */
+    gtk_widget_hide(GTK_WIDGET(by_score));
+#endif
+    while (gtk_dialog_run(dlg) == GTK_RESPONSE_OK)
+    {
+        pattern = gtk_entry_get_text(entry);
+        new_mode = gtk_combo_box_get_active(mode);
+        if (new_mode == NAME_FILTER_SHELL && strcmp(pattern, "*") == 0)
+            pattern = NULL;
+        if (fm_tab_page_set_filter(page, pattern, new_mode,
+                                   gtk_toggle_button_get_active(by_score),
+                                   &error))
+        {
+            gtk_window_set_title(GTK_WINDOW(win), fm_tab_page_get_title(page));
+            break;
+        }
+        /* keep the dialog so user can correct the pattern */
+        gtk_label_set_text(error_label, error->message);
+        gtk_widget_show(GTK_WIDGET(error_label));
+        gtk_widget_grab_focus(GTK_WIDGET(entry));
+        g_error_free(error);
+        error = NULL;
+    }
+    gtk_widget_destroy(GTK_WIDGET(dlg));
 }
 #endif
 
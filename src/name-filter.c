@@ -0,0 +1,692 @@
+/*
+ *      name-filter.c: compiled shell patterns for file names
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "name-filter.h"
+
+#include <string.h>
+#include <fnmatch.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define HAVE_SSE2 1
+#endif
+
+/* The pattern is split by '*' into segments which match a fixed number of
+   characters each. The first segment is matched at the start of the name
+   and the last one at its end unless the pattern starts or ends with '*',
+   every other segment is matched at its leftmost place after the previous
+   one, which is enough for such patterns. Segments without '?' and '[]'
+   are compared as plain bytes.
+   Name matches fuzzy pattern if it has all characters of the pattern in the
+   same order. The match is scored the same way as fzf does in its v1 mode:
+   the shortest substring which ends at the leftmost match is found and each
+   matched character gets points, with a bonus for ones which start a word
+   or follow another matched one, and a penalty for gaps between them. */
+
+typedef enum
+{
+    TOKEN_CHAR, /* the character c */
+    TOKEN_ANY, /* '?' */
+    TOKEN_CLASS /* '[...]', pairs of ranges */
+} NameFilterTokenType;
+
+typedef struct
+{
+    NameFilterTokenType type;
+    gboolean negate; /* '[!...]' */
+    gunichar c;
+    guint n_ranges;
+    gunichar *ranges; /* n_ranges pairs of first and last character */
+} NameFilterToken;
+
+typedef struct
+{
+    char *literal; /* bytes to compare if there are no tokens */
+    gsize len;
+    NameFilterToken *tokens;
+    guint n_tokens;
+} NameFilterSegment;
+
+struct _NameFilter
+{
+    NameFilterSegment *segments;
+    guint n_segments;
+    gboolean anchored_start : 1; /* pattern doesn't start with '*' */
+    gboolean anchored_end : 1; /* pattern doesn't end with '*' */
+    gboolean is_regex : 1; /* regex is used */
+    char *fallback; /* pattern which we don't compile, see fnmatch(3) */
+    char *fuzzy; /* characters which should be in the name in this order */
+    GRegex *regex;
+};
+
+/**
+ * name_filter_make_key
+ * @name: display name of a file
+ *
+ * Makes casefolded and normalized copy of @name. Patterns and names should
+ * be converted by this function to be compared by name_filter_match().
+ *
+ * Returns: (transfer full): a newly allocated string.
+ */
+char *name_filter_make_key(const char *name)
+{
+    const char *p;
+    char *casefold, *key;
+
+    /* both casefolding and normalization don't change ASCII but case */
+    for (p = name; *p; p++)
+        if ((guchar)*p >= 0x80)
+            break;
+    if (*p == '\0')
+        return g_ascii_strdown(name, -1);
+    casefold = g_utf8_casefold(name, -1);
+    key = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
+    g_free(casefold);
+    /* invalid UTF-8 cannot be normalized so let it never match */
+    return key ? key : g_strdup("");
+}
+
+/**
+ * name_filter_make_pattern
+ * @pattern: pattern entered by user
+ * @mode: how @pattern will be matched
+ *
+ * Converts @pattern the same way as name_filter_make_key() does for names
+ * so it can be given to name_filter_new(). Regular expressions are only
+ * normalized, they are matched ignoring case.
+ *
+ * Returns: (transfer full): a newly allocated string.
+ */
+char *name_filter_make_pattern(const char *pattern, NameFilterMode mode)
+{
+    char *normal;
+
+    if (mode != NAME_FILTER_REGEX)
+        return name_filter_make_key(pattern);
+    /* casefolding could change meaning of escapes such as \D */
+    normal = g_utf8_normalize(pattern, -1, G_NORMALIZE_ALL);
+    return normal ? normal : g_strdup(pattern);
+}
+
+static NameFilter *_new_regex(const char *pattern, GError **error)
+{
+    NameFilter *filter;
+    GRegex *regex;
+
+    regex = g_regex_new(pattern, G_REGEX_CASELESS | G_REGEX_OPTIMIZE, 0, error);
+    if (regex == NULL)
+        return NULL;
+    filter = g_slice_new0(NameFilter);
+    filter->is_regex = TRUE;
+    filter->regex = regex;
+    return filter;
+}
+
+/* parses '[...]' at *pp into token, returns FALSE if it's not a class */
+static gboolean _parse_class(const char **pp, NameFilterToken *token,
+                             gboolean *unsupported)
+{
+    const char *p = *pp + 1;
+    GArray *ranges;
+    gunichar first, last;
+
+    token->negate = (*p == '!' || *p == '^');
+    if (token->negate)
+        p++;
+    /* ']' right after the bracket is a member of the class */
+    if (*p == ']')
+        p++;
+    while (*p && *p != ']')
+    {
+        if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.'))
+        {
+            /* named classes are left to fnmatch() */
+            *unsupported = TRUE;
+            return FALSE;
+        }
+        if (*p == '\\' && p[1])
+            p++;
+        p++;
+    }
+    if (*p != ']')
+        return FALSE; /* no closing bracket so '[' is an ordinary char */
+
+    p = *pp + 1 + (token->negate ? 1 : 0);
+    ranges = g_array_new(FALSE, FALSE, sizeof(gunichar));
+    do
+    {
+        if (*p == '\\' && p[1])
+            p++;
+        first = g_utf8_get_char(p);
+        p = g_utf8_next_char(p);
+        last = first;
+        if (*p == '-' && p[1] && p[1] != ']')
+        {
+            p++;
+            if (*p == '\\' && p[1])
+                p++;
+            last = g_utf8_get_char(p);
+            p = g_utf8_next_char(p);
+        }
+        g_array_append_val(ranges, first);
+        g_array_append_val(ranges, last);
+    }
+    while (*p != ']');
+    token->type = TOKEN_CLASS;
+    token->n_ranges = ranges->len / 2;
+    token->ranges = (gunichar *)g_array_free(ranges, FALSE);
+    *pp = p + 1;
+    return TRUE;
+}
+
+/* moves collected tokens into new segment */
+static void _add_segment(NameFilter *filter, GArray **tokens, GString *literal,
+                         gboolean plain)
+{
+    NameFilterSegment *seg;
+
+    filter->segments = g_renew(NameFilterSegment, filter->segments,
+                               filter->n_segments + 1);
+    seg = &filter->segments[filter->n_segments++];
+    seg->len = literal->len;
+    seg->literal = g_strndup(literal->str, literal->len);
+    /* plain segment contains only TOKEN_CHAR which we don't need */
+    seg->n_tokens = plain ? 0 : (*tokens)->len;
+    seg->tokens = (NameFilterToken *)g_array_free(*tokens, plain);
+    if (plain)
+        seg->tokens = NULL;
+    *tokens = g_array_new(FALSE, FALSE, sizeof(NameFilterToken));
+    g_string_truncate(literal, 0);
+}
+
+/**
+ * name_filter_new
+ * @pattern: pattern made by name_filter_make_pattern()
+ * @mode: how @pattern should be matched
+ * @error: (allow-none): location to store error
+ *
+ * Compiles @pattern for name_filter_match(). The shell pattern is matched
+ * the same way as fnmatch(3) with no flags does it. Only regular
+ * expression may be invalid.
+ *
+ * Returns: (transfer full): new filter, free it with name_filter_free(),
+ * or %NULL if @pattern is invalid.
+ */
+NameFilter *name_filter_new(const char *pattern, NameFilterMode mode,
+                            GError **error)
+{
+    NameFilter *filter;
+    GArray *tokens;
+    GString *literal;
+    NameFilterToken token;
+    gboolean plain = TRUE, unsupported = FALSE, in_segment = FALSE;
+    const char *p = pattern, *next;
+
+    if (mode == NAME_FILTER_REGEX)
+        return _new_regex(pattern, error);
+    filter = g_slice_new0(NameFilter);
+    if (mode == NAME_FILTER_FUZZY)
+    {
+        filter->fuzzy = g_strdup(pattern);
+        return filter;
+    }
+    tokens = g_array_new(FALSE, FALSE, sizeof(NameFilterToken));
+    literal = g_string_new(NULL);
+    filter->anchored_start = (*pattern != '*');
+    filter->anchored_end = TRUE;
+    while (*p && !unsupported)
+    {
+        memset(&token, 0, sizeof(token));
+        switch (*p)
+        {
+        case '*':
+            if (in_segment)
+                _add_segment(filter, &tokens, literal, plain);
+            in_segment = FALSE;
+            plain = TRUE;
+            while (*p == '*')
+                p++;
+            filter->anchored_end = (*p != '\0');
+            continue;
+        case '?':
+            token.type = TOKEN_ANY;
+            plain = FALSE;
+            p++;
+            break;
+        case '[':
+            if (_parse_class(&p, &token, &unsupported))
+            {
+                plain = FALSE;
+                break;
+            }
+            /* fall through */
+        default:
+            if (*p == '\\' && p[1])
+                p++;
+            next = g_utf8_next_char(p);
+            token.type = TOKEN_CHAR;
+            token.c = g_utf8_get_char(p);
+            g_string_append_len(literal, p, next - p);
+            p = next;
+        }
+        g_array_append_val(tokens, token);
+        in_segment = TRUE;
+    }
+    if (unsupported)
+    {
+        /* tokens which weren't moved into a segment yet */
+        while (tokens->len > 0)
+        {
+            g_free(g_array_index(tokens, NameFilterToken, tokens->len - 1).ranges);
+            g_array_set_size(tokens, tokens->len - 1);
+        }
+    }
+    else if (in_segment || (filter->anchored_start && filter->n_segments == 0))
+        _add_segment(filter, &tokens, literal, plain);
+    g_array_free(tokens, TRUE);
+    g_string_free(literal, TRUE);
+    if (unsupported)
+    {
+        /* drop whatever was compiled, we let fnmatch() do the work */
+        name_filter_free(filter);
+        filter = g_slice_new0(NameFilter);
+        filter->fallback = g_strdup(pattern);
+    }
+    return filter;
+}
+
+/**
+ * name_filter_free
+ * @filter: filter to free
+ *
+ * Releases all resources allocated by name_filter_new().
+ */
+void name_filter_free(NameFilter *filter)
+{
+    guint i, j;
+
+    for (i = 0; i < filter->n_segments; i++)
+    {
+        for (j = 0; j < filter->segments[i].n_tokens; j++)
+            g_free(filter->segments[i].tokens[j].ranges);
+        g_free(filter->segments[i].tokens);
+        g_free(filter->segments[i].literal);
+    }
+    g_free(filter->segments);
+    g_free(filter->fallback);
+    g_free(filter->fuzzy);
+    if (filter->regex)
+        g_regex_unref(filter->regex);
+    g_slice_free(NameFilter, filter);
+}
+
+/* returns position of needle in hay or NULL */
+static const char *_find_literal(const char *hay, gsize hay_len,
+                                 const char *needle, gsize len)
+{
+    const char *p, *end;
+
+    if (len == 0)
+        return hay;
+    if (len > hay_len)
+        return NULL;
+#ifdef HAVE_SSE2
+    if (len >= 2)
+    {
+        /* test 16 places at once for both first and last byte of needle,
+           only places where both match are compared completely */
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[len - 1]);
+        gsize i;
+
+        for (i = 0; i + len - 1 + 16 <= hay_len; i += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + len - 1));
+            guint mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                         _mm_cmpeq_epi8(b, last)));
+            while (mask)
+            {
+                guint bit = __builtin_ctz(mask);
+
+                if (memcmp(hay + i + bit + 1, needle + 1, len - 2) == 0)
+                    return hay + i + bit;
+                mask &= mask - 1;
+            }
+        }
+        hay += i;
+        hay_len -= i;
+        if (len > hay_len)
+            return NULL;
+    }
+#endif
+    end = hay + hay_len - len;
+    for (p = hay; p <= end; p++)
+    {
+        p = memchr(p, needle[0], end - p + 1);
+        if (p == NULL)
+            return NULL;
+        if (memcmp(p + 1, needle + 1, len - 1) == 0)
+            return p;
+    }
+    return NULL;
+}
+
+static inline gboolean _match_class(const NameFilterToken *token, gunichar c)
+{
+    guint i;
+
+    for (i = 0; i < token->n_ranges; i++)
+        if (c >= token->ranges[2 * i] && c <= token->ranges[2 * i + 1])
+            return !token->negate;
+    return token->negate;
+}
+
+/* matches segment at str, returns end of match or NULL */
+static const char *_match_segment(const NameFilterSegment *seg,
+                                  const char *str, const char *end)
+{
+    guint i;
+    gunichar c;
+
+    if (seg->tokens == NULL)
+    {
+        if ((gsize)(end - str) < seg->len || memcmp(str, seg->literal, seg->len) != 0)
+            return NULL;
+        return str + seg->len;
+    }
+    for (i = 0; i < seg->n_tokens; i++)
+    {
+        if (str >= end)
+            return NULL;
+        c = g_utf8_get_char(str);
+        switch (seg->tokens[i].type)
+        {
+        case TOKEN_CHAR:
+            if (c != seg->tokens[i].c)
+                return NULL;
+            break;
+        case TOKEN_CLASS:
+            if (!_match_class(&seg->tokens[i], c))
+                return NULL;
+            /* fall through */
+        case TOKEN_ANY:
+            break;
+        }
+        str = g_utf8_next_char(str);
+    }
+    return str;
+}
+
+/* finds leftmost match of segment within [str, end), returns its end */
+static const char *_find_segment(const NameFilterSegment *seg,
+                                 const char *str, const char *end)
+{
+    const char *found;
+
+    if (seg->tokens == NULL)
+    {
+        found = _find_literal(str, end - str, seg->literal, seg->len);
+        return found ? found + seg->len : NULL;
+    }
+    for (; str < end; str = g_utf8_next_char(str))
+        if ((found = _match_segment(seg, str, end)) != NULL)
+            return found;
+    return NULL;
+}
+
+/* finds all characters of chars within [str, end) in this order, returns
+   end of the leftmost match or NULL */
+static const char *_find_chars(const char *chars, const char *str, const char *end)
+{
+    const char *next;
+
+    /* UTF-8 lead byte never matches continuation one so compare bytes */
+    for (; *chars; chars = next)
+    {
+        next = g_utf8_next_char(chars);
+        str = _find_literal(str, end - str, chars, next - chars);
+        if (str == NULL)
+            return NULL;
+        str += next - chars;
+    }
+    return str;
+}
+
+/**
+ * name_filter_match
+ * @filter: compiled pattern
+ * @key: name made by name_filter_make_key()
+ * @len: length of @key in bytes
+ *
+ * Tests if @key matches the pattern. This function doesn't allocate any
+ * memory for shell and fuzzy patterns so it may be called for huge number
+ * of names. It may be called from any thread.
+ *
+ * Returns: %TRUE if @key matches.
+ */
+gboolean name_filter_match(const NameFilter *filter, const char *key, gsize len)
+{
+    const char *str = key, *end = key + len, *last_start;
+    const NameFilterSegment *seg;
+    guint first = 0, last = filter->n_segments, i;
+
+    if (filter->fuzzy)
+        return _find_chars(filter->fuzzy, key, end) != NULL;
+    if (filter->is_regex)
+        return g_regex_match(filter->regex, key, 0, NULL);
+    if (G_UNLIKELY(filter->fallback))
+        return fnmatch(filter->fallback, key, 0) == 0;
+    if (filter->anchored_start)
+    {
+        if (filter->n_segments == 0)
+            return len == 0;
+        str = _match_segment(&filter->segments[0], str, end);
+        if (str == NULL)
+            return FALSE;
+        if (filter->n_segments == 1 && filter->anchored_end)
+            return str == end;
+        first = 1;
+    }
+    if (filter->anchored_end && last > first)
+    {
+        /* the last segment matches fixed number of chars at the end */
+        seg = &filter->segments[--last];
+        if (seg->tokens == NULL)
+            last_start = (seg->len <= (gsize)(end - str)) ? end - seg->len : NULL;
+        else
+            for (last_start = end, i = 0; i < seg->n_tokens && last_start > str; i++)
+                last_start = g_utf8_prev_char(last_start);
+        if (last_start == NULL || (seg->tokens && i < seg->n_tokens) ||
+            _match_segment(seg, last_start, end) != end)
+            return FALSE;
+        end = last_start;
+    }
+    for (i = first; i < last; i++)
+    {
+        str = _find_segment(&filter->segments[i], str, end);
+        if (str == NULL)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* points of fuzzy match, the same as fzf uses */
+#define SCORE_MATCH 16
+#define SCORE_GAP_START (-3)
+#define SCORE_GAP_EXTENSION (-1)
+#define BONUS_BOUNDARY (SCORE_MATCH / 2)
+#define BONUS_CONSECUTIVE (-(SCORE_GAP_START + SCORE_GAP_EXTENSION))
+#define BONUS_FIRST_CHAR_MULTIPLIER 2
+
+/* returns bonus for match of character at p */
+static inline int _char_bonus(const char *key, const char *p)
+{
+    gunichar prev;
+
+    if (p == key)
+        return BONUS_BOUNDARY;
+    /* keys are casefolded so only word boundaries are left */
+    prev = g_utf8_get_char(g_utf8_prev_char(p));
+    if (prev < 0x80 && !g_ascii_isalnum(prev))
+        return BONUS_BOUNDARY;
+    return 0;
+}
+
+/**
+ * name_filter_score
+ * @filter: compiled pattern
+ * @key: name made by name_filter_make_key()
+ * @len: length of @key in bytes
+ *
+ * Scores match of @key against fuzzy pattern so better matches can be
+ * shown first, i.e. "fb" scores "foo-bar" above "fabric". Any
+ * other pattern gives the same score to every key which matches it.
+ * This function doesn't allocate any memory.
+ *
+ * Returns: non-negative score, higher is better, or -1 if @key doesn't
+ * match.
+ */
+gint name_filter_score(const NameFilter *filter, const char *key, gsize len)
+{
+    const char *start, *end, *p, *c;
+    int score = 0, bonus, first_bonus = 0, consecutive = 0;
+    gboolean in_gap = FALSE;
+
+    if (filter->fuzzy == NULL)
+        return name_filter_match(filter, key, len) ? 0 : -1;
+    end = _find_chars(filter->fuzzy, key, key + len);
+    if (end == NULL)
+        return -1;
+    /* go back from the end for the shortest match which ends there */
+    start = end;
+    for (c = filter->fuzzy + strlen(filter->fuzzy); c > filter->fuzzy; )
+    {
+        c = g_utf8_prev_char(c);
+        do
+            start = g_utf8_prev_char(start);
+        while (g_utf8_get_char(start) != g_utf8_get_char(c));
+    }
+    for (p = start, c = filter->fuzzy; p < end; p = g_utf8_next_char(p))
+    {
+        if (*c && g_utf8_get_char(p) == g_utf8_get_char(c))
+        {
+            score += SCORE_MATCH;
+            bonus = _char_bonus(key, p);
+            if (consecutive == 0)
+                first_bonus = bonus;
+            else
+            {
+                /* the chunk is worth the most of its starting bonus */
+                if (bonus >= BONUS_BOUNDARY && bonus > first_bonus)
+                    first_bonus = bonus;
+                bonus = MAX(MAX(bonus, first_bonus), BONUS_CONSECUTIVE);
+            }
+            if (c == filter->fuzzy)
+                bonus *= BONUS_FIRST_CHAR_MULTIPLIER;
+            score += bonus;
+            in_gap = FALSE;
+            consecutive++;
+            c = g_utf8_next_char(c);
+        }
+        else
+        {
+            score += in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+            in_gap = TRUE;
+            consecutive = 0;
+            first_bonus = 0;
+        }
+    }
+    return MAX(score, 0);
+}
+
+/**
+ * name_filter_narrows
+ * @filter: new filter
+ * @wider: filter to compare with
+ *
+ * Tests if every key which matches @filter matches @wider as well, so
+ * only keys matched by @wider need to be tested against @filter. The
+ * test is conservative: %FALSE may be returned even if it is so, that
+ * happens if @wider has '?' or classes in it, for example.
+ *
+ * Returns: %TRUE if @filter matches a subset of what @wider matches.
+ */
+gboolean name_filter_narrows(const NameFilter *filter, const NameFilter *wider)
+{
+    const NameFilterSegment *s, *t;
+    const char *at;
+    guint i, j = 0;
+    gsize off = 0; /* bytes of filter->segments[j] already used */
+    gboolean first, last;
+
+    /* adding characters to fuzzy pattern in any place narrows it */
+    if (wider->fuzzy)
+        return filter->fuzzy &&
+               _find_chars(wider->fuzzy, filter->fuzzy,
+                           filter->fuzzy + strlen(filter->fuzzy)) != NULL;
+    if (filter->fuzzy || filter->is_regex || wider->is_regex ||
+        filter->fallback || wider->fallback)
+        return FALSE;
+    if ((wider->anchored_start && !filter->anchored_start) ||
+        (wider->anchored_end && !filter->anchored_end))
+        return FALSE;
+    /* every segment of wider should be found inside segments of filter
+       in the same order, the first and last ones at the same places */
+    for (i = 0; i < wider->n_segments; i++)
+    {
+        s = &wider->segments[i];
+        if (s->tokens)
+            return FALSE;
+        first = (i == 0 && wider->anchored_start);
+        last = (i == wider->n_segments - 1 && wider->anchored_end);
+        for (;; j++, off = 0)
+        {
+            if (j >= filter->n_segments || (first && j > 0))
+                return FALSE;
+            t = &filter->segments[j];
+            if (last && j < filter->n_segments - 1)
+                continue;
+            if (t->tokens)
+            {
+                if (first || last)
+                    return FALSE;
+                continue;
+            }
+            if (last)
+                at = (s->len + off <= t->len) ? t->literal + t->len - s->len : NULL;
+            else
+                at = _find_literal(t->literal + off, t->len - off, s->literal, s->len);
+            if (at && first && at != t->literal)
+                at = NULL;
+            if (at && (!last || memcmp(at, s->literal, s->len) == 0))
+            {
+                off = at - t->literal + s->len;
+                break;
+            }
+            if (first || last)
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
@@ -0,0 +1,56 @@
+/*
+ *      name-filter.h: compiled shell patterns for file names
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __NAME_FILTER_H__
+#define __NAME_FILTER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _NameFilter NameFilter;
+
+/**
+ * NameFilterMode:
+ * @NAME_FILTER_SHELL: shell pattern, see fnmatch(3)
+ * @NAME_FILTER_FUZZY: characters which should be in the name in this order
+ * @NAME_FILTER_REGEX: Perl-compatible regular expression
+ *
+ * How the pattern is matched.
+ */
+typedef enum
+{
+    NAME_FILTER_SHELL,
+    NAME_FILTER_FUZZY,
+    NAME_FILTER_REGEX
+} NameFilterMode;
+
+char *name_filter_make_key(const char *name);
+char *name_filter_make_pattern(const char *pattern, NameFilterMode mode);
+
+NameFilter *name_filter_new(const char *pattern, NameFilterMode mode, GError **error);
+void name_filter_free(NameFilter *filter);
+
+gboolean name_filter_match(const NameFilter *filter, const char *key, gsize len);
+gint name_filter_score(const NameFilter *filter, const char *key, gsize len);
+gboolean name_filter_narrows(const NameFilter *filter, const NameFilter *wider);
+
+G_END_DECLS
+
+#endif /* __NAME_FILTER_H__ */
@@ -24,6 +24,9 @@
 
 #include <gtk/gtk.h>
 #include <libfm/fm.h>
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+# include <unistd.h>
+#endif
 
 G_BEGIN_DECLS
 
@@ -48,6 +51,19 @@ void pcmanfm_save_config(gboolean immediate);
 gboolean pcmanfm_can_open_path_in_terminal(FmPath* dir);
 void pcmanfm_open_folder_in_terminal(GtkWindow* parent, FmPath* dir);
 
+/* number of threads for work split between them, at most 16 */
+static inline int pcmanfm_get_num_processors(void)
+{
+    int n = 1;
+
+#if GLIB_CHECK_VERSION(2, 36, 0)
+    n = g_get_num_processors();
+#elif defined(_SC_NPROCESSORS_ONLN)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return CLAMP(n, 1, 16);
+}
+
 G_END_DECLS
 
 #endif
@@ -26,6 +26,7 @@
 #include <libfm/fm-gtk.h>
 #include <glib/gi18n.h>
 
+#include "pcmanfm.h"
 #include "app-config.h"
 #include "main-win.h"
 #include "tab-page.h"
@@ -33,7 +34,6 @@
 #include "gseal-gtk-compat.h"
 
 #include <stdlib.h>
-#include <fnmatch.h>
 
 /* Additional entries for FmFileMenu popup */
 /* it is also used for FmSidePane context menu popup */
@@ -77,6 +77,16 @@ static void fm_tab_page_finalize(GObject *object);
 static void fm_tab_page_chdir_without_history(FmTabPage* page, FmPath* path);
 static void on_folder_fs_info(FmFolder* folder, FmTabPage* page);
 static void on_folder_start_loading(FmFolder* folder, FmTabPage* page);
+#if FM_CHECK_VERSION(1, 0, 2)
+static void on_folder_files_changed(FmFolder *folder, GSList *files, FmTabPage *page);
+static void cancel_filter_job(FmTabPage *page);
+static void update_filter_sort(FmTabPage *page, FmFolderModel *model);
+#endif
+#if FM_CHECK_VERSION(1, 2, 0)
+static void filter_score_col_init(void);
+static FmFolderModelCol filter_score_col = (FmFolderModelCol)-1;
+static GSList *score_pages = NULL; /* pages sorted by filter_score_col */
+#endif
 static void on_folder_finish_loading(FmFolder* folder, FmTabPage* page);
 static void on_folder_removed(FmFolder* folder, FmTabPage* page);
 static void on_folder_unmount(FmFolder* folder, FmTabPage* page);
@@ -89,6 +99,7 @@ static void  on_folder_view_columns_changed(FmFolderView *fv, FmTabPage *page);
 #endif
 static gboolean on_folder_view_focus_in(GtkWidget *widget, GdkEvent *event, FmTabPage *page);
 static char* format_status_text(FmTabPage* page);
+static void cancel_status_update(FmTabPage* page);
 
 #if GTK_CHECK_VERSION(3, 0, 0)
 static void fm_tab_page_destroy(GtkWidget *page);
@@ -169,6 +180,9 @@ static void fm_tab_page_class_init(FmTabPageClass *klass)
                     G_TYPE_NONE, 0);
 
     popup_qdata = g_quark_from_static_string("tab-page::popup-filelist");
+#if FM_CHECK_VERSION(1, 2, 0)
+    filter_score_col_init();
+#endif
 }
 
 
@@ -187,6 +201,15 @@ static void fm_tab_page_finalize(GObject *object)
 
 #if FM_CHECK_VERSION(1, 0, 2)
     g_free(page->filter_pattern);
+    if (page->filter)
+        name_filter_free(page->filter);
+    if (page->filter_keys)
+        g_hash_table_destroy(page->filter_keys);
+    if (page->filter_levels)
+        g_ptr_array_free(page->filter_levels, TRUE);
+#endif
+#if FM_CHECK_VERSION(1, 2, 0)
+    score_pages = g_slist_remove(score_pages, page);
 #endif
 
     G_OBJECT_CLASS(fm_tab_page_parent_class)->finalize(object);
@@ -200,6 +223,7 @@ static void free_folder(FmTabPage* page)
         g_source_remove(page->update_scroll_id);
         page->update_scroll_id = 0;
     }
+    cancel_status_update(page);
     if(page->folder)
     {
         g_signal_handlers_disconnect_by_func(page->folder, on_folder_start_loading, page);
@@ -209,6 +233,13 @@ static void free_folder(FmTabPage* page)
         g_signal_handlers_disconnect_by_func(page->folder, on_folder_content_changed, page);
         g_signal_handlers_disconnect_by_func(page->folder, on_folder_removed, page);
         g_signal_handlers_disconnect_by_func(page->folder, on_folder_unmount, page);
+#if FM_CHECK_VERSION(1, 0, 2)
+        g_signal_handlers_disconnect_by_func(page->folder, on_folder_files_changed, page);
+        /* levels are kept, they don't refer to files */
+        if (page->filter_keys)
+            g_hash_table_remove_all(page->filter_keys);
+        cancel_filter_job(page);
+#endif
         g_object_unref(page->folder);
         page->folder = NULL;
 #if FM_CHECK_VERSION(1, 2, 0)
@@ -326,6 +357,7 @@ void fm_tab_page_destroy(GtkObject *object)
         g_source_remove(page->update_scroll_id);
         page->update_scroll_id = 0;
     }
+    cancel_status_update(page);
 #if FM_CHECK_VERSION(1, 2, 0)
     fm_side_pane_set_popup_updater(page->side_pane, NULL, NULL);
 #endif
@@ -344,9 +376,8 @@ void fm_tab_page_destroy(GtkObject *object)
 #endif
 }
 
-static void on_folder_content_changed(FmFolder* folder, FmTabPage* page)
+static void update_status_text(FmTabPage* page)
 {
-    /* update status text */
     g_free(page->status_text[FM_STATUS_TEXT_NORMAL]);
     page->status_text[FM_STATUS_TEXT_NORMAL] = format_status_text(page);
     g_signal_emit(page, signals[STATUS], 0,
@@ -354,6 +385,58 @@ static void on_folder_content_changed(FmFolder* folder, FmTabPage* page)
                   page->status_text[FM_STATUS_TEXT_NORMAL]);
 }
 
+/* minimal time between status updates while folder is changed, in ms */
+#define STATUS_UPDATE_INTERVAL 250
+
+static gboolean on_status_update_timeout(gpointer user_data)
+{
+    FmTabPage* page = (FmTabPage*)user_data;
+
+    if(g_source_is_destroyed(g_main_current_source()))
+        return FALSE;
+    if(!page->status_changed)
+    {
+        page->status_update_id = 0;
+        return FALSE;
+    }
+    page->status_changed = FALSE;
+    update_status_text(page);
+    /* continue until changes stop */
+    return TRUE;
+}
+
+static void queue_status_update(FmTabPage* page)
+{
+    /* the first change is shown at once, while it continues to change
+       (i.e. a build writes files there) the status is updated only by
+       on_status_update_timeout() */
+    if(page->status_update_id)
+    {
+        page->status_changed = TRUE;
+        return;
+    }
+    update_status_text(page);
+    page->status_update_id = gdk_threads_add_timeout(STATUS_UPDATE_INTERVAL,
+                                                     on_status_update_timeout,
+                                                     page);
+}
+
+static void cancel_status_update(FmTabPage* page)
+{
+    if(page->status_update_id)
+    {
+        g_source_remove(page->status_update_id);
+        page->status_update_id = 0;
+    }
+    page->status_changed = FALSE;
+}
+
+static void on_folder_content_changed(FmFolder* folder, FmTabPage* page)
+{
+    /* update status text */
+    queue_status_update(page);
+}
+
 static void on_folder_view_sel_changed(FmFolderView* fv, gint n_sel, FmTabPage* page)
 {
     char* msg = page->status_text[FM_STATUS_TEXT_SELECTED_FILES];
@@ -566,24 +649,551 @@ static void _tab_unset_busy_cursor(FmTabPage* page)
 }
 
 #if FM_CHECK_VERSION(1, 0, 2)
+/* Typing the pattern usually makes it narrower each time, like "*re*" after
+   "*r*", so a file rejected by the previous pattern is rejected by the new
+   one as well. Such patterns are kept in a stack of levels, and each file
+   has one record which tells the deepest level it matched and the level
+   which rejected it, so the new pattern is tested only against files which
+   passed the previous one, and if the pattern returns back to one of the
+   previous ones (i.e. on erasing of last typed character) the results are
+   reused without any test. Every level gets an unique stamp so a record
+   made for a level which was dropped from the stack is simply ignored. */
+typedef struct
+{
+    char *pattern;
+    NameFilterMode mode;
+    NameFilter *filter;
+    guint stamp;
+} FmTabFilterLevel;
+
+typedef struct
+{
+    char *key; /* casefolded name, never changed once set */
+    char *name; /* display name for the filter job if key isn't set yet */
+    guint matched; /* stamp of the latest level which matched it */
+    guint rejected; /* stamp of the level which rejected it */
+    guint rejected_depth; /* depth of that level in the stack */
+    gint score; /* fuzzy match score for level with score_stamp */
+    guint score_stamp;
+    guint n_refs; /* the page and filter jobs, used in main thread only */
+} FmTabFilterRecord;
+
+static void free_filter_level(FmTabFilterLevel *level)
+{
+    g_free(level->pattern);
+    name_filter_free(level->filter);
+    g_slice_free(FmTabFilterLevel, level);
+}
+
+static void free_filter_levels(FmTabPage *page)
+{
+    if (page->filter_levels)
+        g_ptr_array_set_size(page->filter_levels, 0);
+}
+
+static void unref_filter_record(FmTabFilterRecord *rec)
+{
+    if (--rec->n_refs > 0)
+        return;
+    g_free(rec->key);
+    g_free(rec->name);
+    g_slice_free(FmTabFilterRecord, rec);
+}
+
+/* makes the top of filter_levels correspond to page->filter_pattern */
+static void update_filter_levels(FmTabPage *page)
+{
+    FmTabFilterLevel *level;
+    guint n;
+
+    if (page->filter_levels == NULL)
+        page->filter_levels = g_ptr_array_new_with_free_func((GDestroyNotify)free_filter_level);
+    for (n = page->filter_levels->len; n > 0; n--)
+    {
+        level = g_ptr_array_index(page->filter_levels, n - 1);
+        if (level->mode == page->filter_mode &&
+            strcmp(level->pattern, page->filter_pattern) == 0)
+        {
+            /* returned back to it */
+            g_ptr_array_set_size(page->filter_levels, n);
+            return;
+        }
+        if (name_filter_narrows(page->filter, level->filter))
+            break;
+    }
+    g_ptr_array_set_size(page->filter_levels, n);
+    level = g_slice_new(FmTabFilterLevel);
+    level->pattern = g_strdup(page->filter_pattern);
+    level->mode = page->filter_mode;
+    level->filter = name_filter_new(level->pattern, level->mode, NULL);
+    level->stamp = ++page->filter_stamp;
+    g_ptr_array_add(page->filter_levels, level);
+}
+
+/* returns known result of the current pattern for the record: 1 if file
+   matches it, 0 if it doesn't, or -1 if that isn't known yet */
+static int lookup_filter_result(FmTabPage *page, FmTabFilterRecord *rec)
+{
+    GPtrArray *levels = page->filter_levels;
+    FmTabFilterLevel *top;
+
+    if (levels == NULL || levels->len == 0)
+        return -1;
+    top = g_ptr_array_index(levels, levels->len - 1);
+    /* a level on the stack rejected it so does every narrower one */
+    if (rec->rejected && rec->rejected_depth < levels->len &&
+        ((FmTabFilterLevel *)g_ptr_array_index(levels, rec->rejected_depth))->stamp == rec->rejected)
+        return 0;
+    /* levels added after the top one are narrower if it's still there */
+    if (rec->matched >= top->stamp)
+        return 1;
+    return -1;
+}
+
+/* saves result of the current pattern for the record */
+static void set_filter_result(FmTabPage *page, FmTabFilterRecord *rec, gboolean matched)
+{
+    GPtrArray *levels = page->filter_levels;
+    FmTabFilterLevel *top;
+
+    if (levels == NULL || levels->len == 0)
+        return;
+    top = g_ptr_array_index(levels, levels->len - 1);
+    if (matched)
+        rec->matched = top->stamp;
+    else
+    {
+        rec->rejected = top->stamp;
+        rec->rejected_depth = levels->len - 1;
+    }
+}
+
+static FmTabFilterRecord *get_filter_record(FmTabPage *page, FmFileInfo *file)
+{
+    FmTabFilterRecord *rec;
+
+    /* the record is made once per file and reused by every later pattern */
+    if (page->filter_keys == NULL)
+        page->filter_keys = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                  (GDestroyNotify)fm_file_info_unref,
+                                                  (GDestroyNotify)unref_filter_record);
+    rec = g_hash_table_lookup(page->filter_keys, file);
+    if (rec == NULL)
+    {
+        rec = g_slice_new0(FmTabFilterRecord);
+        rec->n_refs = 1;
+        g_hash_table_insert(page->filter_keys, fm_file_info_ref(file), rec);
+    }
+    return rec;
+}
+
 static gboolean fm_tab_page_path_filter(FmFileInfo *file, gpointer user_data)
 {
     FmTabPage *page;
-    const char *disp_name;
-    char *casefold, *key;
-    gboolean result;
+    FmTabFilterRecord *rec;
+    gboolean matched;
+    int result;
 
     g_return_val_if_fail(FM_IS_TAB_PAGE(user_data), FALSE);
     page = (FmTabPage*)user_data;
-    if (page->filter_pattern == NULL)
+    if (page->filter == NULL)
         return TRUE;
-    disp_name = fm_file_info_get_disp_name(file);
-    casefold = g_utf8_casefold(disp_name, -1);
-    key = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-    g_free(casefold);
-    result = (fnmatch(page->filter_pattern, key, 0) == 0);
-    g_free(key);
-    return result;
+    rec = get_filter_record(page, file);
+    result = lookup_filter_result(page, rec);
+    if (result >= 0)
+        return result;
+    if (rec->key == NULL)
+        rec->key = name_filter_make_key(fm_file_info_get_disp_name(file));
+    matched = name_filter_match(page->filter, rec->key, strlen(rec->key));
+    set_filter_result(page, rec, matched);
+    return matched;
+}
+
+/* In big folders the pattern is tested in the thread pool, each thread takes
+   a chunk of files which results aren't known yet. The job keeps references
+   to their records, and since the key of a record is never changed once it
+   is set, threads use it as is. Files which have no key yet get one made in
+   the threads from the name saved in the record, that is done once in the
+   file lifetime. When all chunks are done, results are set in the records
+   in the main thread and the model is filtered at once, finding every
+   result there. */
+typedef struct _FmTabFilterJob FmTabFilterJob;
+
+typedef struct
+{
+    FmTabFilterJob *job;
+    guint from, to;
+} FmTabFilterChunk;
+
+struct _FmTabFilterJob
+{
+    FmTabPage *page; /* reference */
+    GCancellable *cancellable;
+    NameFilter *filter;
+    guint n_files;
+    FmTabFilterRecord **records; /* references */
+    const char **keys; /* keys of records at the job start */
+    char **new_keys; /* keys made in threads for records without one */
+    guint32 *matched; /* bitmap, chunks never share a word */
+    FmTabFilterChunk *chunks;
+    volatile gint n_chunks; /* chunks not finished yet */
+#ifdef G_ENABLE_DEBUG
+    GTimer *timer;
+    gdouble start_time; /* time spent to start it in main thread */
+#endif
+};
+
+/* files in a chunk, few enough to check for cancellation often */
+#define FILTER_CHUNK_SIZE 2048
+
+static GThreadPool *filter_pool = NULL;
+static int filter_threads = 1;
+
+static void filter_job_free(FmTabFilterJob *job)
+{
+    guint i;
+
+    for (i = 0; i < job->n_files; i++)
+    {
+        unref_filter_record(job->records[i]);
+        if (job->new_keys)
+            g_free(job->new_keys[i]);
+    }
+    g_free(job->records);
+    g_free(job->keys);
+    g_free(job->new_keys);
+    g_free(job->matched);
+    g_free(job->chunks);
+    name_filter_free(job->filter);
+    g_object_unref(job->cancellable);
+    g_object_unref(job->page);
+#ifdef G_ENABLE_DEBUG
+    g_timer_destroy(job->timer);
+#endif
+    g_slice_free(FmTabFilterJob, job);
+}
+
+static void cancel_filter_job(FmTabPage *page)
+{
+    if (page->filter_job == NULL)
+        return;
+    g_cancellable_cancel(page->filter_job->cancellable);
+    /* it will be freed by on_filter_job_finished() */
+    page->filter_job = NULL;
+}
+
+static gboolean on_filter_job_finished(gpointer user_data)
+{
+    FmTabFilterJob *job = user_data;
+    FmTabPage *page = job->page;
+    FmTabFilterRecord *rec;
+    FmFolderModel *model;
+    guint i;
+#ifdef G_ENABLE_DEBUG
+    gdouble done_time = g_timer_elapsed(job->timer, NULL);
+#endif
+
+    /* ignore result if pattern or folder was changed meanwhile */
+    if (page->filter_job == job)
+    {
+        page->filter_job = NULL;
+        for (i = 0; i < job->n_files; i++)
+        {
+            rec = job->records[i];
+            if (rec->key == NULL)
+            {
+                rec->key = job->new_keys[i];
+                job->new_keys[i] = NULL;
+            }
+            /* the file might be tested in place while the job was running */
+            if (lookup_filter_result(page, rec) < 0)
+                set_filter_result(page, rec, (job->matched[i / 32] >> (i % 32)) & 1);
+        }
+#ifdef G_ENABLE_DEBUG
+        g_debug("FmTabPage: %u files filtered by %d threads in %.3f ms, "
+                "main thread spent %.3f ms to start and %.3f ms to merge",
+                job->n_files, filter_threads, done_time * 1000.0,
+                job->start_time * 1000.0,
+                (g_timer_elapsed(job->timer, NULL) - done_time) * 1000.0);
+#endif
+        model = fm_folder_view_get_model(page->folder_view);
+        if (model)
+        {
+            fm_folder_model_apply_filters(model);
+            update_filter_sort(page, model);
+            queue_status_update(page);
+        }
+    }
+    filter_job_free(job);
+    return FALSE;
+}
+
+static void filter_chunk_run(gpointer data, gpointer unused)
+{
+    FmTabFilterChunk *chunk = data;
+    FmTabFilterJob *job = chunk->job;
+    const char *key;
+    guint i;
+
+    if (!g_cancellable_is_cancelled(job->cancellable))
+    {
+        for (i = chunk->from; i < chunk->to; i++)
+        {
+            key = job->keys[i];
+            if (key == NULL)
+                key = job->new_keys[i] = name_filter_make_key(job->records[i]->name);
+            if (name_filter_match(job->filter, key, strlen(key)))
+                job->matched[i / 32] |= 1U << (i % 32);
+        }
+    }
+    if (g_atomic_int_dec_and_test(&job->n_chunks))
+        gdk_threads_add_idle(on_filter_job_finished, job);
+}
+
+static void filter_pool_init(void)
+{
+    static gsize inited = 0;
+
+    if (g_once_init_enter(&inited))
+    {
+        filter_threads = pcmanfm_get_num_processors();
+        filter_pool = g_thread_pool_new(filter_chunk_run, NULL,
+                                        filter_threads, FALSE, NULL);
+        g_once_init_leave(&inited, 1);
+    }
+}
+
+/* starts testing the pattern in threads if there are enough files which
+   results aren't known yet, returns FALSE if it should be done in place */
+static gboolean start_filter_job(FmTabPage *page)
+{
+    FmFileInfoList *files;
+    FmFileInfo *fi;
+    FmTabFilterRecord *rec;
+    FmTabFilterJob *job;
+    GList *l;
+    guint n, i, size;
+
+    if (app_config->filter_threshold <= 0 || page->folder == NULL)
+        return FALSE;
+    files = fm_folder_get_files(page->folder);
+    if (files == NULL)
+        return FALSE;
+    n = fm_file_info_list_get_length(files);
+    if (n < (guint)app_config->filter_threshold)
+        return FALSE;
+    filter_pool_init();
+    if (filter_pool == NULL)
+        return FALSE;
+    job = g_slice_new0(FmTabFilterJob);
+    job->page = g_object_ref(page);
+    job->cancellable = g_cancellable_new();
+    job->filter = name_filter_new(page->filter_pattern, page->filter_mode, NULL);
+    job->records = g_new(FmTabFilterRecord *, n);
+    job->keys = g_new(const char *, n);
+#ifdef G_ENABLE_DEBUG
+    job->timer = g_timer_new();
+#endif
+    for (l = fm_file_info_list_peek_head_link(files); l; l = l->next)
+    {
+        fi = l->data;
+        rec = get_filter_record(page, fi);
+        if (lookup_filter_result(page, rec) >= 0)
+            continue;
+        /* the name in FmFileInfo may be replaced while threads run */
+        if (rec->key == NULL && rec->name == NULL)
+            rec->name = g_strdup(fm_file_info_get_disp_name(fi));
+        rec->n_refs++;
+        job->records[job->n_files] = rec;
+        job->keys[job->n_files] = rec->key;
+        job->n_files++;
+    }
+    /* narrowed pattern may leave not so much to test */
+    if (job->n_files < (guint)app_config->filter_threshold)
+    {
+        filter_job_free(job);
+        return FALSE;
+    }
+    job->new_keys = g_new0(char *, job->n_files);
+    job->matched = g_new0(guint32, (job->n_files + 31) / 32);
+    n = MIN((guint)filter_threads * 4,
+            (job->n_files + FILTER_CHUNK_SIZE - 1) / FILTER_CHUNK_SIZE);
+    /* chunk bounds are aligned to words of the bitmap */
+    size = ((job->n_files + n - 1) / n + 31) & ~31U;
+    n = (job->n_files + size - 1) / size;
+    job->chunks = g_new(FmTabFilterChunk, n);
+    job->n_chunks = n;
+    page->filter_job = job;
+#ifdef G_ENABLE_DEBUG
+    job->start_time = g_timer_elapsed(job->timer, NULL);
+#endif
+    for (i = 0; i < n; i++)
+    {
+        job->chunks[i].job = job;
+        job->chunks[i].from = i * size;
+        job->chunks[i].to = MIN(job->n_files, (i + 1) * size);
+        g_thread_pool_push(filter_pool, &job->chunks[i], NULL);
+    }
+    return TRUE;
+}
+
+/* sorts the model by match score while the page has such filter, or by
+   the page settings otherwise */
+static void update_filter_sort(FmTabPage *page, FmFolderModel *model)
+{
+#if FM_CHECK_VERSION(1, 2, 0)
+    FmFolderModelCol by;
+    gboolean scored;
+
+    scored = fm_folder_model_get_sort(model, &by, NULL) && by == filter_score_col;
+    if (page->filter && page->filter_by_score)
+    {
+        /* the model doesn't know scores are changed with the pattern so
+           it would not sort again by the same column */
+        if (scored)
+            fm_folder_model_set_sort(model, page->sort_by, page->sort_type);
+        fm_folder_model_set_sort(model, filter_score_col,
+                                 (page->sort_type & ~FM_SORT_ORDER_MASK) | FM_SORT_ASCENDING);
+    }
+    else if (scored)
+        fm_folder_model_set_sort(model, page->sort_by, page->sort_type);
+#endif
+}
+
+#if FM_CHECK_VERSION(1, 2, 0)
+/* The column has no user data so the record of the file is looked up in
+   the pages sorted by score, the latest one first. If the same folder is
+   open in two such pages, files in both are sorted by the latest pattern
+   of them. */
+
+static FmTabFilterRecord *get_score_record(FmFileInfo *fi)
+{
+    FmTabFilterRecord *rec;
+    FmTabFilterLevel *top;
+    FmTabPage *page;
+    GSList *l;
+
+    for (l = score_pages; l; l = l->next)
+    {
+        page = l->data;
+        if (page->filter_keys == NULL ||
+            (rec = g_hash_table_lookup(page->filter_keys, fi)) == NULL)
+            continue;
+        /* the score is made once for the pattern */
+        top = g_ptr_array_index(page->filter_levels, page->filter_levels->len - 1);
+        if (rec->score_stamp != top->stamp)
+        {
+            if (rec->key == NULL)
+                rec->key = name_filter_make_key(fm_file_info_get_disp_name(fi));
+            rec->score = name_filter_score(page->filter, rec->key, strlen(rec->key));
+            rec->score_stamp = top->stamp;
+        }
+        return rec;
+    }
+    return NULL;
+}
+
+static GType filter_score_get_type(void)
+{
+    return G_TYPE_INT;
+}
+
+static void filter_score_get_value(FmFileInfo *fi, GValue *value)
+{
+    FmTabFilterRecord *rec = get_score_record(fi);
+
+    g_value_set_int(value, rec ? rec->score : -1);
+}
+
+static gint filter_score_compare(FmFileInfo *fi1, FmFileInfo *fi2)
+{
+    FmTabFilterRecord *rec1 = get_score_record(fi1);
+    FmTabFilterRecord *rec2 = get_score_record(fi2);
+    gsize len1, len2;
+
+    if (rec1 == NULL || rec2 == NULL)
+        return (rec1 != NULL) - (rec2 != NULL);
+    /* better matches first, then shorter names */
+    if (rec1->score != rec2->score)
+        return rec2->score - rec1->score;
+    len1 = strlen(rec1->key);
+    len2 = strlen(rec2->key);
+    if (len1 != len2)
+        return len1 < len2 ? -1 : 1;
+    return strcmp(rec1->key, rec2->key);
+}
+
+static void filter_score_col_init(void)
+{
+    static FmFolderModelColumnInfo info;
+
+    info.title = _("Match");
+    info.get_type = filter_score_get_type;
+    info.get_value = filter_score_get_value;
+    info.compare = filter_score_compare;
+    filter_score_col = fm_folder_model_add_custom_column("filter-score", &info);
+}
+
+/**
+ * fm_tab_page_is_sorted_by_score
+ * @page: the page instance
+ *
+ * Tests if files in the @page are sorted by score of fuzzy filter match
+ * instead of the page sorting settings.
+ *
+ * Returns: %TRUE if files are sorted by match score.
+ */
+gboolean fm_tab_page_is_sorted_by_score(FmTabPage *page)
+{
+    FmFolderModel *model;
+    FmFolderModelCol by;
+
+    if (page->folder_view == NULL)
+        return FALSE;
+    model = fm_folder_view_get_model(page->folder_view);
+    return model && fm_folder_model_get_sort(model, &by, NULL) &&
+           by == filter_score_col;
+}
+
+/**
+ * fm_tab_page_cancel_sort_by_score
+ * @page: the page instance
+ *
+ * Stops sorting files in the @page by score of fuzzy filter match, the
+ * filter itself is kept. Files are sorted by the page settings then.
+ */
+void fm_tab_page_cancel_sort_by_score(FmTabPage *page)
+{
+    FmFolderModel *model = NULL;
+
+    page->filter_by_score = FALSE;
+    score_pages = g_slist_remove(score_pages, page);
+    if (page->folder_view != NULL)
+        model = fm_folder_view_get_model(page->folder_view);
+    if (model)
+        update_filter_sort(page, model);
+}
+#endif
+
+/* drop cached keys and results for files which were renamed or removed */
+static void on_folder_files_changed(FmFolder *folder, GSList *files, FmTabPage *page)
+{
+    if (page->filter_keys)
+        for (; files; files = files->next)
+            g_hash_table_remove(page->filter_keys, files->data);
+    /* the running job may test old names, start it again */
+    if (page->filter_job)
+    {
+        FmFolderModel *model = fm_folder_view_get_model(page->folder_view);
+
+        cancel_filter_job(page);
+        if (!start_filter_job(page) && model)
+        {
+            fm_folder_model_apply_filters(model);
+            update_filter_sort(page, model);
+            queue_status_update(page);
+        }
+    }
 }
 #endif
 
@@ -608,6 +1218,7 @@ static void on_folder_start_loading(FmFolder* folder, FmTabPage* page)
         }
         fm_folder_view_set_model(fv, model);
         fm_folder_model_set_sort(model, page->sort_by, page->sort_type);
+        update_filter_sort(page, model);
         g_object_unref(model);
     }
     else
@@ -671,6 +1282,7 @@ static void on_folder_finish_loading(FmFolder* folder, FmTabPage* page)
         }
         /* since 1.0.2 sorting should be applied on model instead of view */
         fm_folder_model_set_sort(model, page->sort_by, page->sort_type);
+        update_filter_sort(page, model);
 #endif
         g_object_unref(model);
     }
@@ -684,11 +1296,7 @@ static void on_folder_finish_loading(FmFolder* folder, FmTabPage* page)
 
     /* update status bar */
     /* update status text */
-    g_free(page->status_text[FM_STATUS_TEXT_NORMAL]);
-    page->status_text[FM_STATUS_TEXT_NORMAL] = format_status_text(page);
-    g_signal_emit(page, signals[STATUS], 0,
-                  (guint)FM_STATUS_TEXT_NORMAL,
-                  page->status_text[FM_STATUS_TEXT_NORMAL]);
+    update_status_text(page);
 
     _tab_unset_busy_cursor(page);
     /* g_debug("finish-loading"); */
@@ -1059,6 +1667,10 @@ static void fm_tab_page_chdir_without_history(FmTabPage* page, FmPath* path)
     g_signal_connect(page->folder, "removed", G_CALLBACK(on_folder_removed), page);
     g_signal_connect(page->folder, "unmount", G_CALLBACK(on_folder_unmount), page);
     g_signal_connect(page->folder, "content-changed", G_CALLBACK(on_folder_content_changed), page);
+#if FM_CHECK_VERSION(1, 0, 2)
+    g_signal_connect(page->folder, "files-changed", G_CALLBACK(on_folder_files_changed), page);
+    g_signal_connect(page->folder, "files-removed", G_CALLBACK(on_folder_files_changed), page);
+#endif
 
 #if FM_CHECK_VERSION(1, 2, 0)
     page->want_focus = prev_path;
@@ -1163,11 +1775,7 @@ void fm_tab_page_set_show_hidden(FmTabPage* page, gboolean show_hidden)
     fm_side_pane_set_show_hidden(page->side_pane, show_hidden);
 #endif
     /* update status text */
-    g_free(page->status_text[FM_STATUS_TEXT_NORMAL]);
-    page->status_text[FM_STATUS_TEXT_NORMAL] = format_status_text(page);
-    g_signal_emit(page, signals[STATUS], 0,
-                  (guint)FM_STATUS_TEXT_NORMAL,
-                  page->status_text[FM_STATUS_TEXT_NORMAL]);
+    update_status_text(page);
 }
 
 FmPath* fm_tab_page_get_cwd(FmTabPage* page)
@@ -1400,25 +2008,45 @@ FmFolderView *fm_tab_page_get_passive_view(FmTabPage *page)
 
 #if FM_CHECK_VERSION(1, 0, 2)
 /**
- * fm_tab_page_set_filter_pattern
+ * fm_tab_page_set_filter
  * @page: the page instance
  * @pattern: (allow-none): new pattern
+ * @mode: how @pattern should be matched
+ * @by_score: %TRUE to show best matches of fuzzy @pattern first
+ * @error: (allow-none): location to store error
  *
  * Changes filter for the folder view in the @page. If @pattern is %NULL
- * then folder contents will be not filtered anymore.
+ * then folder contents will be not filtered anymore. Files can be sorted
+ * by match score only with libfm 1.2 or newer, @by_score is ignored with
+ * older versions.
+ *
+ * Returns: %FALSE if @pattern is invalid, the filter is not changed then.
  */
-void fm_tab_page_set_filter_pattern(FmTabPage *page, const char *pattern)
+gboolean fm_tab_page_set_filter(FmTabPage *page, const char *pattern,
+                                NameFilterMode mode, gboolean by_score,
+                                GError **error)
 {
     FmFolderModel *model = NULL;
-    char *disp_name;
+    NameFilter *filter = NULL;
+    char *key = NULL, *disp_name;
 
     /* validate pattern */
     if (pattern && pattern[0] == '\0')
         pattern = NULL;
+    if (pattern)
+    {
+        key = name_filter_make_pattern(pattern, mode);
+        filter = name_filter_new(key, mode, error);
+        if (filter == NULL)
+        {
+            g_free(key);
+            return FALSE;
+        }
+    }
     if (page->folder_view != NULL)
         model = fm_folder_view_get_model(page->folder_view);
     if (page->filter_pattern == NULL && pattern == NULL)
-        return; /* nothing to change */
+        return TRUE; /* nothing to change */
     /* if we have model then update filter chain in it */
     if (model)
     {
@@ -1428,18 +2056,39 @@ void fm_tab_page_set_filter_pattern(FmTabPage *page, const char *pattern)
             fm_folder_model_remove_filter(model, fm_tab_page_path_filter, page);
     }
     /* update page own data */
+    cancel_filter_job(page);
     g_free(page->filter_pattern);
-    if (pattern)
-    {
-        char *casefold = g_utf8_casefold(pattern, -1);
-        page->filter_pattern = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-        g_free(casefold);
-    }
-    else
-        page->filter_pattern = NULL;
+    if (page->filter)
+        name_filter_free(page->filter);
+    page->filter_pattern = key;
+    page->filter = filter;
+    page->filter_mode = mode;
+    page->filter_by_score = (filter && by_score && mode == NAME_FILTER_FUZZY);
+#if FM_CHECK_VERSION(1, 2, 0)
+    score_pages = g_slist_remove(score_pages, page);
+    if (page->filter_by_score)
+        score_pages = g_slist_prepend(score_pages, page);
+#endif
     /* apply changes if needed */
-    if (model)
+    if (page->filter)
+        update_filter_levels(page);
+    else
+        free_filter_levels(page);
+    if (model && (page->filter == NULL || !start_filter_job(page)))
+    {
+#ifdef G_ENABLE_DEBUG
+        GTimer *timer = g_timer_new();
+#endif
         fm_folder_model_apply_filters(model);
+#ifdef G_ENABLE_DEBUG
+        g_debug("FmTabPage: filter \"%s\" applied in %.3f ms",
+                page->filter_pattern ? page->filter_pattern : "",
+                g_timer_elapsed(timer, NULL) * 1000.0);
+        g_timer_destroy(timer);
+#endif
+        update_filter_sort(page, model);
+        queue_status_update(page);
+    }
     /* update tab page title */
     disp_name = fm_path_display_basename(fm_folder_view_get_cwd(page->folder_view));
     if (page->filter_pattern)
@@ -1451,5 +2100,19 @@ void fm_tab_page_set_filter_pattern(FmTabPage *page, const char *pattern)
     }
     fm_tab_label_set_text(page->tab_label, disp_name);
     g_free(disp_name);
+    return TRUE;
+}
+
+/**
+ * fm_tab_page_set_filter_pattern
+ * @page: the page instance
+ * @pattern: (allow-none): new shell pattern
+ *
+ * Changes filter for the folder view in the @page. If @pattern is %NULL
+ * then folder contents will be not filtered anymore.
+ */
+void fm_tab_page_set_filter_pattern(FmTabPage *page, const char *pattern)
+{
+    fm_tab_page_set_filter(page, pattern, NAME_FILTER_SHELL, FALSE, NULL);
 }
 #endif
@@ -25,6 +25,7 @@
 #include <libfm/fm.h>
 
 #include "pcmanfm.h"
+#include "name-filter.h"
 
 G_BEGIN_DECLS
 
@@ -71,6 +72,12 @@ struct _FmTabPage
     FmFolderModelCol sort_by;
     char **columns; /* NULL if own_config is FALSE */
     char *filter_pattern;
+    NameFilter *filter; /* compiled filter_pattern */
+    NameFilterMode filter_mode;
+    GHashTable *filter_keys; /* FmFileInfo -> FmTabFilterRecord */
+    GPtrArray *filter_levels; /* stack of narrowed patterns, latest last */
+    guint filter_stamp; /* last stamp given to a filter level */
+    struct _FmTabFilterJob *filter_job; /* filtering in threads */
 #else
     GtkSortType sort_type;
     int sort_by;
@@ -79,7 +86,10 @@ struct _FmTabPage
     gboolean show_hidden : 1;
     gboolean own_config : 1;
     gboolean busy : 1;
+    gboolean status_changed : 1; /* folder changed while status_update_id */
+    gboolean filter_by_score : 1; /* sort by fuzzy filter match score */
     guint update_scroll_id;
+    guint status_update_id;
 };
 
 struct _FmTabPageClass
@@ -142,6 +152,13 @@ FmFolderView *fm_tab_page_get_passive_view(FmTabPage *page);
 
 #if FM_CHECK_VERSION(1, 0, 2)
 void fm_tab_page_set_filter_pattern(FmTabPage *page, const char *pattern);
+gboolean fm_tab_page_set_filter(FmTabPage *page, const char *pattern,
+                                NameFilterMode mode, gboolean by_score,
+                                GError **error);
+#endif
+#if FM_CHECK_VERSION(1, 2, 0)
+gboolean fm_tab_page_is_sorted_by_score(FmTabPage *page);
+void fm_tab_page_cancel_sort_by_score(FmTabPage *page);
 #endif
 
 #if FM_CHECK_VERSION(1, 2, 0)
@@ -0,0 +1,366 @@
+/*
+ *      test-image-ops.c: tests for fast operations on image data
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+/* static functions of each code path are tested directly */
+#include "image-ops.c"
+
+#include <stdio.h>
+
+/* The test image has no details finer than a quarter of its size so every
+   filter gives nearly the same result on it, the difference comes only
+   from shapes of filters and from handling of edges. These are limits of
+   that difference from gdk_pixbuf_scale_simple() for each sample, colors
+   are compared weighted by alpha. */
+#define MAX_MEAN_DIFF 2.0
+#define MAX_DIFF 16
+
+typedef enum
+{
+    TEST_IMAGE_RGB,
+    TEST_IMAGE_RGBA, /* opaque */
+    TEST_IMAGE_HOLE, /* left third is transparent with inverted colors */
+    TEST_IMAGE_HOLE_BLACK /* the same but transparent pixels are black */
+} TestImage;
+
+static const char *mode_names[] = { "compat", "fast", "best" };
+static const char *image_names[] = { "RGB ", "RGBA", "hole" };
+
+static GdkPixbuf *make_image(int width, int height, TestImage type)
+{
+    GdkPixbuf *pix = gdk_pixbuf_new(GDK_COLORSPACE_RGB, type != TEST_IMAGE_RGB,
+                                    8, width, height);
+    int n_channels = gdk_pixbuf_get_n_channels(pix);
+    int rowstride = gdk_pixbuf_get_rowstride(pix);
+    guchar *p;
+    double fx, fy;
+    int x, y;
+
+    for(y = 0; y < height; y++)
+    {
+        p = gdk_pixbuf_get_pixels(pix) + (gsize)y * rowstride;
+        fy = (double)y / height;
+        for(x = 0; x < width; x++, p += n_channels)
+        {
+            fx = (double)x / width;
+            p[0] = (guchar)(128.0 + 100.0 * sin(2.0 * M_PI * 4.0 * fx));
+            p[1] = (guchar)(255.0 * fy);
+            p[2] = (guchar)(128.0 + 100.0 * cos(2.0 * M_PI * 3.0 * (fx + fy)));
+            if(type == TEST_IMAGE_RGBA)
+                p[3] = 255;
+            else
+            {
+                /* the edge of hole is a ramp which is wider than filters
+                   so Lanczos doesn't ring on it */
+                p[3] = CLAMP((x - width / 3) * 16 + 8, 0, 255);
+                /* colors which would show as halo if they are not ignored */
+                if(p[3] == 0 && type == TEST_IMAGE_HOLE)
+                {
+                    p[0] = 255 - p[0];
+                    p[1] = 255 - p[1];
+                    p[2] = 255 - p[2];
+                }
+                else if(p[3] == 0)
+                    p[0] = p[1] = p[2] = 0;
+            }
+        }
+    }
+    return pix;
+}
+
+static gboolean check_scale(int src_w, int src_h, int dest_w, int dest_h,
+                            TestImage type, ImageOpsScaleMode mode)
+{
+    GdkPixbuf *src = make_image(src_w, src_h, type);
+    GdkPixbuf *ref = gdk_pixbuf_scale_simple(src, dest_w, dest_h, GDK_INTERP_BILINEAR);
+    GdkPixbuf *res = image_ops_scale(src, dest_w, dest_h, mode);
+    int n_channels = gdk_pixbuf_get_n_channels(ref);
+    int len = dest_w * n_channels, x, y, d, max_diff = 0, n_junk = 0;
+    GdkPixbuf *black;
+    const guchar *a, *b;
+    double mean_diff = 0.0;
+    gboolean ok;
+
+    for(y = 0; y < dest_h; y++)
+    {
+        a = gdk_pixbuf_get_pixels(ref) + (gsize)y * gdk_pixbuf_get_rowstride(ref);
+        b = gdk_pixbuf_get_pixels(res) + (gsize)y * gdk_pixbuf_get_rowstride(res);
+        for(x = 0; x < len; x++)
+        {
+            d = ABS((int)a[x] - (int)b[x]);
+            /* colors of transparent pixels don't matter */
+            if(n_channels == 4 && x % 4 != 3)
+                d = d * a[x - x % 4 + 3] / 255;
+            mean_diff += d;
+            max_diff = MAX(max_diff, d);
+        }
+    }
+    mean_diff /= (double)len * dest_h;
+    ok = (mean_diff <= MAX_MEAN_DIFF && max_diff <= MAX_DIFF);
+    if(type == TEST_IMAGE_HOLE)
+    {
+        /* colors of transparent pixels should not change anything */
+        g_object_unref(src);
+        src = make_image(src_w, src_h, TEST_IMAGE_HOLE_BLACK);
+        black = image_ops_scale(src, dest_w, dest_h, mode);
+        for(y = 0; y < dest_h; y++)
+        {
+            a = gdk_pixbuf_get_pixels(black) + (gsize)y * gdk_pixbuf_get_rowstride(black);
+            b = gdk_pixbuf_get_pixels(res) + (gsize)y * gdk_pixbuf_get_rowstride(res);
+            for(x = 0; x < len; x++)
+                if(b[x - x % 4 + 3] != 0) /* a visible pixel */
+                    n_junk += (a[x] != b[x]);
+        }
+        g_object_unref(black);
+        ok = ok && (n_junk == 0);
+    }
+    printf("%-6s %4dx%-4d -> %4dx%-4d %s: mean difference %.3f, max %d",
+           mode_names[mode], src_w, src_h, dest_w, dest_h,
+           image_names[type], mean_diff, max_diff);
+    if(type == TEST_IMAGE_HOLE)
+        printf(", %d samples depend on transparent pixels", n_junk);
+    printf(": %s\n", ok ? "ok" : "FAILED");
+    g_object_unref(res);
+    g_object_unref(ref);
+    g_object_unref(src);
+    return ok;
+}
+
+/* the loop which was used before image_ops_unpremultiply(); it wrapped
+   samples greater than alpha around, which cairo never gives, now these
+   are saturated */
+static guint8 unpremultiply_div(guint c, guint a)
+{
+    if(a == 0)
+        return 0;
+    return MIN((c * 255 + a / 2) / a, 255);
+}
+
+typedef void (*UnpremultiplyFunc)(const guint32 *src, guint8 *dest, int width);
+
+static const struct
+{
+    const char *name;
+    UnpremultiplyFunc func;
+} unpremultiply_paths[] = {
+    { "scalar", unpremultiply_row_scalar },
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN && defined(HAVE_SSE2)
+    { "sse2", unpremultiply_row_sse2 },
+#endif
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN && defined(HAVE_NEON)
+    { "neon", unpremultiply_row_neon },
+#endif
+};
+
+/* every pair of alpha and sample in every channel; the row of 253 pixels
+   leaves a tail after the vector loop */
+static gboolean check_unpremultiply(UnpremultiplyFunc func, const char *name)
+{
+    static const int widths[] = { 256, 253 };
+    guint32 src[256];
+    guint8 dest[256 * 4];
+    guint a, c[3], i, w, x, n_diff = 0;
+
+    for(w = 0; w < G_N_ELEMENTS(widths); w++)
+        for(a = 0; a < 256; a++)
+        {
+            for(x = 0; x < 256; x++)
+                src[x] = (a << 24) | (x << 16) | (((x + 85) & 0xff) << 8) |
+                         ((x + 170) & 0xff);
+            memset(dest, 0, sizeof(dest));
+            func(src, dest, widths[w]);
+            for(x = 0; x < (guint)widths[w]; x++)
+            {
+                c[0] = (src[x] >> 16) & 0xff;
+                c[1] = (src[x] >> 8) & 0xff;
+                c[2] = src[x] & 0xff;
+                for(i = 0; i < 3; i++)
+                    if(dest[x * 4 + i] != unpremultiply_div(c[i], a))
+                    {
+                        if(n_diff++ == 0)
+                            printf("%-6s alpha %u sample %u: %u instead of %u\n",
+                                   name, a, c[i], dest[x * 4 + i],
+                                   unpremultiply_div(c[i], a));
+                    }
+                if(dest[x * 4 + 3] != a)
+                    n_diff++;
+            }
+        }
+    printf("%-6s unpremultiply: %u differences: %s\n", name, n_diff,
+           n_diff ? "FAILED" : "ok");
+    return n_diff == 0;
+}
+
+static const struct
+{
+    const char *name;
+    ScaleFunc func;
+} scale_horiz_paths[] = {
+#ifdef HAVE_SSE2
+    { "sse2", scale_horiz_sse2 },
+#endif
+}, scale_vert_paths[] = {
+#ifdef HAVE_SSE2
+    { "sse2", scale_vert_sse2 },
+#endif
+#ifdef HAVE_AVX2
+    { "avx2", scale_vert_avx2 },
+#endif
+};
+
+/* resampled lengths with each filter; Lanczos has negative coefficients
+   which make sums overflow and saturate on random samples */
+static const struct
+{
+    int in, out;
+    ImageOpsFilter filter;
+    double support;
+} scale_coef_cases[] = {
+    { 1024, 512, filter_box, 0.5 },
+    { 1024, 301, filter_box, 0.5 },
+    { 301, 1000, filter_triangle, 1.0 },
+    { 1024, 301, filter_lanczos, 3.0 },
+    { 301, 1000, filter_lanczos, 3.0 }
+};
+
+/* one pass compared with the scalar one on random samples; rows of 37
+   pixels leave a tail after the vector loop of the vertical pass */
+static gboolean check_scale_func(ScaleFunc func, ScaleFunc ref,
+                                 const char *name, gboolean vert)
+{
+    guint8 *src, *dest, *expected;
+    int c, n_channels, width, rows, src_stride, dest_stride, len, y;
+    guint seed = 1, n_diff = 0, i;
+    gsize size;
+    ScaleCoefs sc;
+
+    for(c = 0; c < (int)G_N_ELEMENTS(scale_coef_cases); c++)
+        for(n_channels = 3; n_channels <= 4; n_channels++)
+        {
+            scale_coefs_init(&sc, scale_coef_cases[c].in, scale_coef_cases[c].out,
+                             scale_coef_cases[c].filter,
+                             scale_coef_cases[c].support);
+            width = vert ? 37 : scale_coef_cases[c].out;
+            rows = vert ? scale_coef_cases[c].out : 5;
+            /* strides with padding as in GdkPixbuf */
+            src_stride = ((vert ? width : scale_coef_cases[c].in) * n_channels + 3) & ~3;
+            dest_stride = (width * n_channels + 3) & ~3;
+            size = (gsize)src_stride * (vert ? scale_coef_cases[c].in : rows);
+            src = g_malloc(size);
+            for(i = 0; i < size; i++)
+            {
+                seed = seed * 1103515245 + 12345;
+                src[i] = seed >> 16;
+            }
+            dest = g_malloc0((gsize)dest_stride * rows);
+            expected = g_malloc0((gsize)dest_stride * rows);
+            ref(src, src_stride, expected, dest_stride, n_channels, width, &sc, 0, rows);
+            func(src, src_stride, dest, dest_stride, n_channels, width, &sc, 0, rows);
+            len = width * n_channels;
+            for(y = 0; y < rows; y++)
+                n_diff += (memcmp(dest + (gsize)y * dest_stride,
+                                  expected + (gsize)y * dest_stride, len) != 0);
+            g_free(expected);
+            g_free(dest);
+            g_free(src);
+            scale_coefs_clear(&sc);
+        }
+    printf("%-6s %s pass: %u rows differ from scalar: %s\n", name,
+           vert ? "vertical" : "horizontal", n_diff, n_diff ? "FAILED" : "ok");
+    return n_diff == 0;
+}
+
+static gboolean check_scale_funcs(void)
+{
+    gboolean ok = TRUE;
+    guint i;
+
+    for(i = 0; i < G_N_ELEMENTS(scale_horiz_paths); i++)
+        ok &= check_scale_func(scale_horiz_paths[i].func, scale_horiz_scalar,
+                               scale_horiz_paths[i].name, FALSE);
+    for(i = 0; i < G_N_ELEMENTS(scale_vert_paths); i++)
+    {
+#ifdef HAVE_AVX2
+        __builtin_cpu_init();
+        if(scale_vert_paths[i].func == scale_vert_avx2 &&
+           !__builtin_cpu_supports("avx2"))
+        {
+            printf("%-6s vertical pass: skipped, not supported by the CPU\n",
+                   scale_vert_paths[i].name);
+            continue;
+        }
+#endif
+        ok &= check_scale_func(scale_vert_paths[i].func, scale_vert_scalar,
+                               scale_vert_paths[i].name, TRUE);
+    }
+    return ok;
+}
+
+static void time_scale(int src_w, int src_h, int dest_w, int dest_h)
+{
+    GdkPixbuf *src = make_image(src_w, src_h, TEST_IMAGE_RGB), *res;
+    GTimer *timer = g_timer_new();
+    int mode;
+
+    for(mode = IMAGE_OPS_SCALE_COMPAT; mode <= IMAGE_OPS_SCALE_BEST; mode++)
+    {
+        g_timer_start(timer);
+        res = image_ops_scale(src, dest_w, dest_h, mode);
+        printf("%-6s %4dx%-4d -> %4dx%-4d: %8.1f ms\n", mode_names[mode],
+               src_w, src_h, dest_w, dest_h,
+               g_timer_elapsed(timer, NULL) * 1000.0);
+        g_object_unref(res);
+    }
+    g_timer_destroy(timer);
+    g_object_unref(src);
+}
+
+int main(int argc, char **argv)
+{
+    gboolean ok = TRUE;
+    int mode, type;
+    guint i;
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+    g_type_init();
+#endif
+    for(mode = IMAGE_OPS_SCALE_FAST; mode <= IMAGE_OPS_SCALE_BEST; mode++)
+        for(type = TEST_IMAGE_RGB; type <= TEST_IMAGE_HOLE; type++)
+        {
+            ok &= check_scale(1024, 768, 512, 384, type, mode); /* by half */
+            ok &= check_scale(1024, 768, 301, 217, type, mode); /* by odd ratio */
+            ok &= check_scale(400, 300, 1000, 750, type, mode); /* enlarge */
+            ok &= check_scale(1024, 768, 1280, 600, type, mode); /* mixed */
+        }
+    ok &= check_scale_funcs();
+    unpremultiply_init();
+    for(i = 0; i < G_N_ELEMENTS(unpremultiply_paths); i++)
+        ok &= check_unpremultiply(unpremultiply_paths[i].func,
+                                  unpremultiply_paths[i].name);
+    /* timings are not checked, these are printed only with --bench */
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+        time_scale(3840, 2160, 1920, 1080);
+        time_scale(7680, 4320, 3840, 2160);
+    }
+    return ok ? 0 : 1;
+}